@@ -0,0 +1,249 @@
+#include "arena.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+using namespace std;
+
+namespace Arena {
+    namespace {
+        constexpr size_t ALIGNMENT = alignof(max_align_t);
+        constexpr size_t CLASS_COUNT = MAX_BLOCK_SIZE / ALIGNMENT;
+//        free blocks a thread keeps per class, in bytes; beyond it half of
+//        them go back to the depot, so that chunks can be released.  Each
+//        kept block may pin a chunk, so this is kept small
+        constexpr size_t MAX_THREAD_FREE_BYTES = CHUNK_SIZE / 16;
+
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+//        header at the start of every chunk, which is aligned to its size,
+//        so the chunk of a block is found by masking its address; all
+//        blocks of a chunk are of one class
+        struct Chunk {
+            size_t cls;
+//            blocks carved so far; written only by the owner while active
+            size_t carved;
+//            guarded by the depot: whether a thread still carves blocks
+//            from it, and its free blocks held by the depot
+            bool active;
+            size_t free_count;
+            FreeBlock* free;
+//            in the list of chunks of its class with free blocks in the
+//            depot
+            Chunk* prev;
+            Chunk* next;
+        };
+        constexpr size_t HEADER_SIZE = (sizeof(Chunk) + ALIGNMENT - 1)
+            / ALIGNMENT * ALIGNMENT;
+
+        size_t class_of(size_t size) {
+            return (size + ALIGNMENT - 1) / ALIGNMENT - 1;
+        }
+        size_t size_of(size_t cls) {
+            return (cls + 1) * ALIGNMENT;
+        }
+        size_t capacity(size_t cls) {
+            return (CHUNK_SIZE - HEADER_SIZE) / size_of(cls);
+        }
+        Chunk* chunk_of(void* block) {
+            return reinterpret_cast<Chunk*>(
+                reinterpret_cast<uintptr_t>(block) & ~(CHUNK_SIZE - 1)
+            );
+        }
+        char* block_at(Chunk* chunk, size_t index) {
+            return reinterpret_cast<char*>(chunk) + HEADER_SIZE
+                + index * size_of(chunk->cls);
+        }
+
+        atomic<uint64_t> held_bytes{0};
+
+        Chunk* new_chunk(size_t cls) {
+            void* memory = ::operator new(CHUNK_SIZE,
+                                          align_val_t(CHUNK_SIZE));
+            held_bytes.fetch_add(CHUNK_SIZE, memory_order_relaxed);
+            return new (memory) Chunk{cls, 0, true, 0, nullptr,
+                                      nullptr, nullptr};
+        }
+        void delete_chunk(Chunk* chunk) {
+            held_bytes.fetch_sub(CHUNK_SIZE, memory_order_relaxed);
+            ::operator delete(chunk, align_val_t(CHUNK_SIZE));
+        }
+
+//        free blocks returned by threads, kept by chunk, so that a chunk
+//        whose blocks are all back is released
+        struct Depot {
+            mutex mtx;
+            Chunk* with_free[CLASS_COUNT] = {};
+        };
+        Depot& depot() {
+            static Depot* ret = new Depot;
+            return *ret;
+        }
+
+        void unlink(Depot& shared, Chunk* chunk) {
+            (chunk->prev != nullptr ? chunk->prev->next
+                                    : shared.with_free[chunk->cls])
+                = chunk->next;
+            if (chunk->next != nullptr) {
+                chunk->next->prev = chunk->prev;
+            }
+            chunk->prev = chunk->next = nullptr;
+        }
+//        with the depot locked
+        void release_if_free(Depot& shared, Chunk* chunk) {
+            if (!chunk->active && chunk->free_count == chunk->carved) {
+                if (chunk->free_count > 0) {
+                    unlink(shared, chunk);
+                }
+                delete_chunk(chunk);
+            }
+        }
+        void give_locked(Depot& shared, FreeBlock* block) {
+            Chunk* chunk = chunk_of(block);
+            block->next = chunk->free;
+            chunk->free = block;
+            if (chunk->free_count++ == 0) {
+                chunk->next = shared.with_free[chunk->cls];
+                if (chunk->next != nullptr) {
+                    chunk->next->prev = chunk;
+                }
+                shared.with_free[chunk->cls] = chunk;
+            }
+            release_if_free(shared, chunk);
+        }
+
+//        takes all free blocks of one chunk, so that a thread fills a chunk
+//        rather than scattering its blocks over many
+        FreeBlock* take_from_depot(size_t cls, size_t& count) {
+            auto& shared = depot();
+            lock_guard lock(shared.mtx);
+            Chunk* chunk = shared.with_free[cls];
+            if (chunk == nullptr) {
+                return nullptr;
+            }
+            FreeBlock* ret = chunk->free;
+            count = chunk->free_count;
+            chunk->free = nullptr;
+            chunk->free_count = 0;
+            unlink(shared, chunk);
+            return ret;
+        }
+        void give_to_depot(FreeBlock* block) {
+            auto& shared = depot();
+            lock_guard lock(shared.mtx);
+            give_locked(shared, block);
+        }
+        void deactivate(Chunk* chunk) {
+            auto& shared = depot();
+            lock_guard lock(shared.mtx);
+            chunk->active = false;
+            release_if_free(shared, chunk);
+        }
+
+//        trivially destructible, so that nodes released during static
+//        destruction can still reach it
+        struct Pool {
+            FreeBlock* free[CLASS_COUNT];
+            size_t free_count[CLASS_COUNT];
+//            chunk blocks are carved from, per class
+            Chunk* bump[CLASS_COUNT];
+            bool retired;
+        };
+        thread_local Pool pool;
+
+//        moves the free blocks of cls beyond keep to the depot
+        void trim(size_t cls, size_t keep) {
+            auto& shared = depot();
+            lock_guard lock(shared.mtx);
+            while (pool.free_count[cls] > keep) {
+                FreeBlock* block = pool.free[cls];
+                pool.free[cls] = block->next;
+                pool.free_count[cls]--;
+                give_locked(shared, block);
+            }
+        }
+        void retire() {
+            for (size_t cls = 0; cls < CLASS_COUNT; cls++) {
+                trim(cls, 0);
+                if (pool.bump[cls] != nullptr) {
+                    deactivate(pool.bump[cls]);
+                    pool.bump[cls] = nullptr;
+                }
+            }
+            pool.retired = true;
+        }
+        struct Retirer {
+            ~Retirer() {
+                retire();
+            }
+        };
+        thread_local Retirer retirer;
+
+//        registers the per-thread destructor; called wherever blocks or
+//        chunks come to be held by the thread
+        void enroll() {
+            static_cast<void>(&retirer);
+        }
+    }
+
+    void* allocate(size_t size) {
+        if (size > MAX_BLOCK_SIZE) {
+            return ::operator new(size);
+        }
+        size_t cls = class_of(size);
+        if (FreeBlock* block = pool.free[cls]) {
+            pool.free[cls] = block->next;
+            pool.free_count[cls]--;
+            return block;
+        }
+        Chunk* chunk = pool.bump[cls];
+        if (chunk == nullptr) {
+            enroll();
+            size_t count = 0;
+            if (FreeBlock* block = take_from_depot(cls, count)) {
+                pool.free[cls] = block->next;
+                pool.free_count[cls] = count - 1;
+                return block;
+            }
+            chunk = new_chunk(cls);
+            if (!pool.retired) {
+                pool.bump[cls] = chunk;
+            }
+        }
+        void* ret = block_at(chunk, chunk->carved++);
+//        a full chunk, or any after retirement, which nothing would finish
+//        later, may be released as soon as its blocks are free
+        if (chunk->carved == capacity(cls) || pool.retired) {
+            deactivate(chunk);
+            pool.bump[cls] = nullptr;
+        }
+        return ret;
+    }
+
+    void deallocate(void* ptr, size_t size) {
+        if (size > MAX_BLOCK_SIZE) {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t cls = class_of(size);
+        auto* block = static_cast<FreeBlock*>(ptr);
+        if (pool.retired) {
+            give_to_depot(block);
+            return;
+        }
+        enroll();
+        block->next = pool.free[cls];
+        pool.free[cls] = block;
+        if (++pool.free_count[cls] * size_of(cls) > MAX_THREAD_FREE_BYTES) {
+            trim(cls, pool.free_count[cls] / 2);
+        }
+    }
+
+    uint64_t chunk_bytes() {
+        return held_bytes.load(memory_order_relaxed);
+    }
+}
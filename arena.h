@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+//    pool allocator for expression nodes: small blocks of equal size are
+//    carved out of large chunks and recycled through per-thread free lists,
+//    so building nodes does not go to the global allocator once warm;
+//    chunks whose blocks are all free again are returned to it
+namespace Arena {
+    constexpr size_t CHUNK_SIZE = 64 * 1024;
+    constexpr size_t MAX_BLOCK_SIZE = 256;
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr, size_t size);
+//    bytes of chunks held, whether their blocks are in use or free
+    uint64_t chunk_bytes();
+
+    template<typename T>
+    struct Allocator {
+        using value_type = T;
+
+        Allocator() = default;
+        template<typename U>
+        Allocator(const Allocator<U>&) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(Arena::allocate(n * sizeof(T)));
+        }
+        void deallocate(T* ptr, size_t n) {
+            Arena::deallocate(ptr, n * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const Allocator<U>&) const {
+            return true;
+        }
+        template<typename U>
+        bool operator!=(const Allocator<U>&) const {
+            return false;
+        }
+    };
+}
@@ -0,0 +1,186 @@
+#include "batch.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace Batch {
+    namespace {
+        thread_local vector<unique_ptr<double[]>> pool;
+
+        enum class Op {
+            ADD,
+            SUB,
+            MUL,
+            DIV
+        };
+
+        template<Op op>
+        double scalar(double l, double r) {
+            switch (op) {
+                case Op::ADD:
+                    return l + r;
+                case Op::SUB:
+                    return l - r;
+                case Op::MUL:
+                    return l * r;
+                case Op::DIV:
+                    return l / r;
+            }
+            throw logic_error("Unreachable code");
+        }
+
+//        applies a packed arithmetic instruction to whole registers and
+//        finishes the tail with the scalar operation; AVX2 is compiled for
+//        every x86 build and chosen at run time if the CPU has it
+#if defined(__x86_64__) || defined(__i386__)
+        template<Op op>
+        __attribute__((target("avx2")))
+        void apply_avx2(const double* a, const double* b, double* out,
+                        size_t n) {
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m256d l = _mm256_loadu_pd(a + i);
+                __m256d r = _mm256_loadu_pd(b + i);
+                __m256d ret;
+                if constexpr (op == Op::ADD) {
+                    ret = _mm256_add_pd(l, r);
+                } else if constexpr (op == Op::SUB) {
+                    ret = _mm256_sub_pd(l, r);
+                } else if constexpr (op == Op::MUL) {
+                    ret = _mm256_mul_pd(l, r);
+                } else {
+                    ret = _mm256_div_pd(l, r);
+                }
+                _mm256_storeu_pd(out + i, ret);
+            }
+            for (; i < n; i++) {
+                out[i] = scalar<op>(a[i], b[i]);
+            }
+        }
+
+        bool has_avx2() {
+            static const bool ret = [] {
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2") != 0;
+            }();
+            return ret;
+        }
+#endif
+
+        template<Op op>
+        void apply(const double* a, const double* b, double* out, size_t n) {
+#if defined(__x86_64__) || defined(__i386__)
+            if (has_avx2()) {
+                apply_avx2<op>(a, b, out, n);
+                return;
+            }
+#endif
+            size_t i = 0;
+#if defined(__SSE2__)
+            for (; i + 2 <= n; i += 2) {
+                __m128d l = _mm_loadu_pd(a + i);
+                __m128d r = _mm_loadu_pd(b + i);
+                __m128d ret;
+                if constexpr (op == Op::ADD) {
+                    ret = _mm_add_pd(l, r);
+                } else if constexpr (op == Op::SUB) {
+                    ret = _mm_sub_pd(l, r);
+                } else if constexpr (op == Op::MUL) {
+                    ret = _mm_mul_pd(l, r);
+                } else {
+                    ret = _mm_div_pd(l, r);
+                }
+                _mm_storeu_pd(out + i, ret);
+            }
+#endif
+            for (; i < n; i++) {
+                out[i] = scalar<op>(a[i], b[i]);
+            }
+        }
+    }
+
+    Buffer::Buffer() {
+        if (pool.empty()) {
+            data_ = make_unique<double[]>(BLOCK_SIZE);
+        } else {
+            data_ = move(pool.back());
+            pool.pop_back();
+        }
+    }
+    Buffer::~Buffer() {
+        pool.push_back(move(data_));
+    }
+    double* Buffer::data() {
+        return data_.get();
+    }
+
+    void fill(double val, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = val;
+        }
+    }
+    void copy(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = a[i];
+        }
+    }
+
+    void sum(const double* a, const double* b, double* out, size_t n) {
+        apply<Op::ADD>(a, b, out, n);
+    }
+    void diff(const double* a, const double* b, double* out, size_t n) {
+        apply<Op::SUB>(a, b, out, n);
+    }
+    void mult(const double* a, const double* b, double* out, size_t n) {
+        apply<Op::MUL>(a, b, out, n);
+    }
+    void div(const double* a, const double* b, double* out, size_t n) {
+        apply<Op::DIV>(a, b, out, n);
+    }
+//    transcendental functions stay on libm, so that batch results are
+//    bit-identical to Node::Base::evaluate
+    void pow(const double* a, const double* b, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::pow(a[i], b[i]);
+        }
+    }
+
+    void sin(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::sin(a[i]);
+        }
+    }
+    void cos(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::cos(a[i]);
+        }
+    }
+    void tan(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::tan(a[i]);
+        }
+    }
+    void cot(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = 1 / std::tan(a[i]);
+        }
+    }
+    void neg(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = -a[i];
+        }
+    }
+    void ln(const double* a, double* out, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = std::log(a[i]);
+        }
+    }
+}
+
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+//    kernels for evaluating a node over a block of points at once;
+//    output may alias any of the inputs
+namespace Batch {
+    constexpr size_t BLOCK_SIZE = 256;
+
+//    scratch block taken from a per-thread pool, so that evaluation
+//    does not allocate once the pool is warm
+    class Buffer {
+    public:
+        Buffer();
+        ~Buffer();
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        double* data();
+    private:
+        std::unique_ptr<double[]> data_;
+    };
+
+    void fill(double val, double* out, size_t n);
+    void copy(const double* a, double* out, size_t n);
+
+    void sum(const double* a, const double* b, double* out, size_t n);
+    void diff(const double* a, const double* b, double* out, size_t n);
+    void mult(const double* a, const double* b, double* out, size_t n);
+    void div(const double* a, const double* b, double* out, size_t n);
+    void pow(const double* a, const double* b, double* out, size_t n);
+
+    void sin(const double* a, double* out, size_t n);
+    void cos(const double* a, double* out, size_t n);
+    void tan(const double* a, double* out, size_t n);
+    void cot(const double* a, double* out, size_t n);
+    void neg(const double* a, double* out, size_t n);
+    void ln(const double* a, double* out, size_t n);
+}
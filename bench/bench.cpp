@@ -0,0 +1,345 @@
+#include "bench/generator.h"
+#include "bytecode.h"
+#include "expression.h"
+#include "simplify.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+//    every allocation of the process goes through these, so that stages
+//    report how much they ask of the global allocator
+namespace {
+    atomic<uint64_t> allocations{0};
+    atomic<uint64_t> allocated_bytes{0};
+
+//    allocates for operator new with at least the given alignment; not
+//    inlined, so that the compiler does not pair free with operator new
+    [[gnu::noinline]] void* counted_allocate(size_t size, size_t alignment) {
+        allocations.fetch_add(1, memory_order_relaxed);
+        allocated_bytes.fetch_add(size, memory_order_relaxed);
+        size = size == 0 ? 1 : size;
+        void* ret = nullptr;
+        if (alignment <= alignof(max_align_t)) {
+            ret = malloc(size);
+        } else if (posix_memalign(&ret, alignment, size) != 0) {
+            ret = nullptr;
+        }
+        if (ret == nullptr) {
+            throw bad_alloc();
+        }
+        return ret;
+    }
+    [[gnu::noinline]] void counted_free(void* ptr) noexcept {
+        free(ptr);
+    }
+}
+
+void* operator new(size_t size) {
+    return counted_allocate(size, alignof(max_align_t));
+}
+void* operator new(size_t size, align_val_t alignment) {
+    return counted_allocate(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr) noexcept {
+    counted_free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    counted_free(ptr);
+}
+void operator delete(void* ptr, align_val_t) noexcept {
+    counted_free(ptr);
+}
+void operator delete(void* ptr, size_t, align_val_t) noexcept {
+    counted_free(ptr);
+}
+
+namespace {
+    using Clock = chrono::steady_clock;
+
+//    every stage repeats over all inputs for at least this long
+    constexpr chrono::milliseconds MIN_TIME(300);
+    constexpr double POINT = 0.7;
+    constexpr size_t BATCH_POINTS = 256;
+
+    struct Options {
+        uint64_t seed = 1;
+//        expressions generated
+        size_t count = 200;
+        GeneratorOptions generator;
+        string json;
+        string compare;
+    };
+
+    struct Result {
+        string name;
+        double ns_per_op;
+        double allocs_per_op;
+        double bytes_per_op;
+    };
+
+//    keeps results alive, so that the work producing them is not dropped
+    volatile const void* sink;
+
+//    round runs the stage over all inputs once and performs ops operations;
+//    the first round only warms up the arena and the table of nodes
+    template<typename F>
+    Result measure(const string& name, size_t ops, F round) {
+        round();
+        uint64_t allocs_before = allocations.load();
+        uint64_t bytes_before = allocated_bytes.load();
+        size_t rounds = 0;
+        auto start = Clock::now();
+        chrono::nanoseconds elapsed;
+        do {
+            round();
+            rounds++;
+            elapsed = Clock::now() - start;
+        } while (elapsed < MIN_TIME);
+        double total = static_cast<double>(rounds) * ops;
+        return {
+            name,
+            elapsed.count() / total,
+            (allocations.load() - allocs_before) / total,
+            (allocated_bytes.load() - bytes_before) / total
+        };
+    }
+
+    string options_json(const Options& options) {
+        const GeneratorOptions& gen = options.generator;
+        const OperatorMix& mix = gen.mix;
+        ostringstream out;
+        out << "{\"seed\": " << options.seed
+            << ", \"count\": " << options.count
+            << ", \"depth\": " << gen.depth
+            << ", \"size\": " << gen.size
+            << ", \"mix\": [" << mix.sum << ", " << mix.diff << ", "
+            << mix.mult << ", " << mix.div << ", " << mix.pow << ", "
+            << mix.func << "]}";
+        return out.str();
+    }
+
+//    one result per line, which is all that read_baseline relies on
+    void write_json(const string& path, const Options& options,
+                    const vector<Result>& results) {
+        ofstream out(path);
+        out << setprecision(6);
+        out << "{\n  \"options\": " << options_json(options)
+            << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            out << "    {\"name\": \"" << result.name << "\""
+                << ", \"ns_per_op\": " << result.ns_per_op
+                << ", \"allocs_per_op\": " << result.allocs_per_op
+                << ", \"bytes_per_op\": " << result.bytes_per_op << "}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        if (!out) {
+            throw runtime_error("Cannot write " + path);
+        }
+    }
+
+    unordered_map<string, Result> read_baseline(const string& path,
+                                                const Options& options) {
+        ifstream in(path);
+        if (!in) {
+            throw runtime_error("Cannot read " + path);
+        }
+        unordered_map<string, Result> ret;
+        for (string line; getline(in, line); ) {
+            if (line.find("\"options\"") != string::npos
+                && line.find(options_json(options)) == string::npos) {
+                cerr << "Baseline was taken with other options: " << line
+                    << endl;
+            }
+            char name[64];
+            Result result;
+            if (sscanf(line.c_str(),
+                       " {\"name\": \"%63[^\"]\", \"ns_per_op\": %lf,"
+                       " \"allocs_per_op\": %lf, \"bytes_per_op\": %lf",
+                       name, &result.ns_per_op, &result.allocs_per_op,
+                       &result.bytes_per_op) == 4) {
+                result.name = name;
+                ret.emplace(name, result);
+            }
+        }
+        return ret;
+    }
+
+    void print_results(const vector<Result>& results,
+                       const unordered_map<string, Result>& baseline) {
+        cout << left << setw(16) << "stage" << right
+            << setw(14) << "ns/op" << setw(14) << "allocs/op"
+            << setw(14) << "bytes/op";
+        if (!baseline.empty()) {
+            cout << setw(14) << "base ns/op" << setw(10) << "change";
+        }
+        cout << '\n' << fixed;
+        for (const Result& result : results) {
+            cout << left << setw(16) << result.name << right
+                << setprecision(1) << setw(14) << result.ns_per_op
+                << setprecision(2) << setw(14) << result.allocs_per_op
+                << setprecision(1) << setw(14) << result.bytes_per_op;
+            if (auto it = baseline.find(result.name); it != baseline.end()) {
+                double change = result.ns_per_op / it->second.ns_per_op - 1;
+                cout << setprecision(1) << setw(14) << it->second.ns_per_op
+                    << showpos << setw(9) << change * 100 << '%'
+                    << noshowpos;
+            }
+            cout << '\n';
+        }
+    }
+
+    bool parse_mix(const char* arg, OperatorMix& mix) {
+        return sscanf(arg, "%lf,%lf,%lf,%lf,%lf,%lf", &mix.sum, &mix.diff,
+                      &mix.mult, &mix.div, &mix.pow, &mix.func) == 6;
+    }
+
+    bool parse_options(int argc, char* argv[], Options& options) {
+        for (int i = 1; i < argc; i++) {
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const char* value = argv[++i];
+            if (strcmp(argv[i - 1], "--seed") == 0) {
+                options.seed = strtoull(value, nullptr, 10);
+            } else if (strcmp(argv[i - 1], "--count") == 0
+                       && atoi(value) > 0) {
+                options.count = atoi(value);
+            } else if (strcmp(argv[i - 1], "--depth") == 0
+                       && atoi(value) > 0) {
+                options.generator.depth = atoi(value);
+            } else if (strcmp(argv[i - 1], "--size") == 0
+                       && atoi(value) > 0) {
+                options.generator.size = atoi(value);
+            } else if (strcmp(argv[i - 1], "--mix") == 0
+                       && parse_mix(value, options.generator.mix)) {
+            } else if (strcmp(argv[i - 1], "--json") == 0) {
+                options.json = value;
+            } else if (strcmp(argv[i - 1], "--compare") == 0) {
+                options.compare = value;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    vector<Result> run(const Options& options) {
+        ExpressionGenerator generator(options.generator, options.seed);
+        vector<string> inputs;
+        for (size_t i = 0; i < options.count; i++) {
+            inputs.push_back(generator.next());
+        }
+        vector<Node::Ptr> trees;
+        vector<Node::Ptr> raw_derivatives;
+        vector<Bytecode::Program> programs;
+        for (const string& input : inputs) {
+            trees.push_back(parse_expression(input));
+            raw_derivatives.push_back(trees.back()->derivative());
+            programs.push_back(Bytecode::compile(trees.back().get()));
+        }
+        size_t n = inputs.size();
+
+        vector<Result> results;
+        results.push_back(measure("parse", n, [&] {
+            for (const string& input : inputs) {
+                sink = parse_expression(input).get();
+            }
+        }));
+        results.push_back(measure("canonicalize", n, [&] {
+            for (const Node::Ptr& der : raw_derivatives) {
+                sink = canonicalize(der).get();
+            }
+        }));
+//        as saved expressions are differentiated: raw orders one from
+//        another, the last one canonicalized
+        for (size_t order = 1; order <= 3; order++) {
+            results.push_back(measure(
+                "derivative_" + to_string(order), n, [&] {
+                    for (const Node::Ptr& tree : trees) {
+                        Node::DerivativeCache cache;
+                        Node::Ptr der = tree;
+                        for (size_t i = 0; i < order; i++) {
+                            der = der->derivative(cache);
+                        }
+                        sink = canonicalize(der).get();
+                    }
+                }
+            ));
+        }
+        volatile double value_sink;
+        results.push_back(measure("evaluate_tree", n, [&] {
+            for (const Node::Ptr& tree : trees) {
+                value_sink = tree->evaluate(POINT);
+            }
+        }));
+        results.push_back(measure("evaluate_code", n, [&] {
+            for (const Bytecode::Program& program : programs) {
+                value_sink = program.evaluate(POINT);
+            }
+        }));
+        vector<double> xs(BATCH_POINTS);
+        vector<double> out(BATCH_POINTS);
+        for (size_t i = 0; i < BATCH_POINTS; i++) {
+            xs[i] = POINT + i * 1e-3;
+        }
+        results.push_back(measure("evaluate_batch", n * BATCH_POINTS, [&] {
+            for (const Bytecode::Program& program : programs) {
+                program.evaluate_batch(xs.data(), out.data(), BATCH_POINTS);
+            }
+            value_sink = out[0];
+        }));
+        results.push_back(measure("print", n, [&] {
+            for (const Node::Ptr& tree : trees) {
+                ostringstream out;
+                out << tree.get();
+                value_sink = out.str().size();
+            }
+        }));
+        return results;
+    }
+}
+
+//    measures every stage of the calculator on generated expressions:
+//    time, allocations and allocated bytes per expression, or per point for
+//    evaluate_batch
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        cerr << "Usage: " << argv[0]
+            << " [--seed <n>] [--count <n>] [--depth <n>] [--size <n>]\n"
+            << "       [--mix <sum>,<diff>,<mult>,<div>,<pow>,<func>]"
+            << " [--json <file>] [--compare <file>]" << endl;
+        return 1;
+    }
+    try {
+        unordered_map<string, Result> baseline;
+        if (!options.compare.empty()) {
+            baseline = read_baseline(options.compare, options);
+        }
+        vector<Result> results = run(options);
+        print_results(results, baseline);
+        if (!options.json.empty()) {
+            write_json(options.json, options, results);
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
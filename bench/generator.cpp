@@ -0,0 +1,80 @@
+#include "bench/generator.h"
+
+#include <array>
+
+using namespace std;
+
+namespace {
+//    in the order of the fields of OperatorMix
+    enum Op { SUM, DIFF, MULT, DIV, POW, FUNC };
+
+    constexpr array<const char*, 4> BINARY_OPS = {" + ", " - ", " * ", " / "};
+    constexpr array<const char*, 6> FUNCS = {
+        "sin", "cos", "tan", "cot", "ln", "-"
+    };
+}
+
+ExpressionGenerator::ExpressionGenerator(const GeneratorOptions& options,
+                                         uint64_t seed)
+: options_(options), rng_(seed) {}
+
+string ExpressionGenerator::next() {
+    string ret;
+    generate(ret, options_.depth, options_.size);
+    return ret;
+}
+
+void ExpressionGenerator::generate(string& out, size_t depth, size_t ops) {
+    if (depth == 0 || ops == 0) {
+        leaf(out);
+        return;
+    }
+    const OperatorMix& mix = options_.mix;
+    discrete_distribution<int> pick({
+        mix.sum, mix.diff, mix.mult, mix.div, mix.pow, mix.func
+    });
+    int op = pick(rng_);
+    switch (op) {
+        case FUNC: {
+            const char* func = FUNCS[rng_() % FUNCS.size()];
+//            unary minus is read only at the start of braces, so it is
+//            braced itself
+            bool neg = func == FUNCS.back();
+            out += neg ? "(-(" : string(func) + '(';
+            generate(out, depth - 1, ops - 1);
+            out += neg ? "))" : ")";
+            return;
+        }
+//        small constant exponents keep values finite and derivatives of a
+//        size comparable to those of real inputs
+        case POW:
+            out += '(';
+            generate(out, depth - 1, ops - 1);
+            out += ") ^ ";
+            out += to_string(2 + rng_() % 3);
+            return;
+        default: {
+            size_t left_ops = rng_() % ops;
+            out += '(';
+            generate(out, depth - 1, left_ops);
+            out += BINARY_OPS[op];
+            generate(out, depth - 1, ops - 1 - left_ops);
+            out += ')';
+            return;
+        }
+    }
+}
+
+void ExpressionGenerator::leaf(string& out) {
+    switch (rng_() % 4) {
+        case 0:
+            out += to_string(1 + rng_() % 9);
+            break;
+        case 1:
+            out += "0.5";
+            break;
+        default:
+            out += 'x';
+            break;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+//    relative frequencies of the operations in generated expressions
+struct OperatorMix {
+    double sum = 4;
+    double diff = 2;
+    double mult = 4;
+    double div = 1;
+    double pow = 1;
+    double func = 2;
+};
+
+struct GeneratorOptions {
+//    longest path from the root to a leaf
+    size_t depth = 8;
+//    operations per expression, if depth allows
+    size_t size = 24;
+    OperatorMix mix;
+};
+
+//    random expressions in the input syntax of the calculator; the same seed
+//    gives the same sequence, so runs of different versions are comparable
+class ExpressionGenerator {
+public:
+    ExpressionGenerator(const GeneratorOptions& options, uint64_t seed);
+    std::string next();
+private:
+    GeneratorOptions options_;
+    std::mt19937_64 rng_;
+
+    void generate(std::string& out, size_t depth, size_t ops);
+    void leaf(std::string& out);
+};
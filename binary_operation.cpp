@@ -1,5 +1,7 @@
 #include "binary_operation.h"
 
+#include <stdexcept>
+
 namespace BinaryOp {
     Ptr& Ptr::operator=(Ptr&& other) {
         return static_cast<Ptr&>(
@@ -74,6 +76,27 @@ namespace BinaryOp {
     char Pow::repr() const {
         return '^';
     }
+    
+    const Base& get(Type type) {
+        static const Sum sum;
+        static const Diff diff;
+        static const Mult mult;
+        static const Div div;
+        static const Pow pow;
+        switch (type) {
+            case Type::SUM:
+                return sum;
+            case Type::DIFF:
+                return diff;
+            case Type::MULT:
+                return mult;
+            case Type::DIV:
+                return div;
+            case Type::POW:
+                return pow;
+        }
+        throw std::logic_error("Unreachable code");
+    }
 }
 std::ostream& operator<<(std::ostream& out, const BinaryOp::Base& op) {
     return out << op.repr();
@@ -70,5 +70,8 @@ namespace BinaryOp {
         Type get_type() const final;
         char repr() const final;
     };
+    
+//    shared stateless instance for the given type
+    const Base& get(Type type);
 }
 std::ostream& operator<<(std::ostream& out, const BinaryOp::Base& op);
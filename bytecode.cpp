@@ -0,0 +1,623 @@
+#include "bytecode.h"
+#include "batch.h"
+#include "expression_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Bytecode {
+    namespace {
+//        value with its directional derivative, so that a reverse sweep over
+//        tangents computes Hessian-vector products
+        struct Tangent {
+            double value;
+            double tangent;
+        };
+        Tangent operator+(Tangent a, Tangent b) {
+            return {a.value + b.value, a.tangent + b.tangent};
+        }
+        Tangent operator-(Tangent a, Tangent b) {
+            return {a.value - b.value, a.tangent - b.tangent};
+        }
+        Tangent operator-(Tangent a) {
+            return {-a.value, -a.tangent};
+        }
+        Tangent operator*(Tangent a, Tangent b) {
+            return {a.value * b.value, a.tangent * b.value + a.value * b.tangent};
+        }
+        Tangent operator/(Tangent a, Tangent b) {
+            return {
+                a.value / b.value,
+                (a.tangent * b.value - a.value * b.tangent) / (b.value * b.value)
+            };
+        }
+        Tangent& operator+=(Tangent& a, Tangent b) {
+            return a = a + b;
+        }
+        Tangent& operator-=(Tangent& a, Tangent b) {
+            return a = a - b;
+        }
+        Tangent sin(Tangent a) {
+            return {std::sin(a.value), std::cos(a.value) * a.tangent};
+        }
+        Tangent cos(Tangent a) {
+            return {std::cos(a.value), -std::sin(a.value) * a.tangent};
+        }
+        Tangent tan(Tangent a) {
+            double c = std::cos(a.value);
+            return {std::tan(a.value), a.tangent / (c * c)};
+        }
+        Tangent log(Tangent a) {
+            return {std::log(a.value), a.tangent / a.value};
+        }
+        Tangent pow(Tangent a, Tangent b) {
+            double value = std::pow(a.value, b.value);
+            if (b.tangent == 0) {
+                if (a.tangent == 0) {
+                    return {value, 0};
+                }
+                return {
+                    value,
+                    b.value * std::pow(a.value, b.value - 1) * a.tangent
+                };
+            }
+            return {
+                value,
+                value * (a.tangent * b.value / a.value
+                         + std::log(a.value) * b.tangent)
+            };
+        }
+
+        template<typename T>
+        T lift(double val);
+        template<>
+        double lift(double val) {
+            return val;
+        }
+        template<>
+        Tangent lift(double val) {
+            return {val, 0};
+        }
+
+        bool is_zero(double val) {
+            return val == 0;
+        }
+
+//        registers of evaluate_batch at most; large programs evaluate
+//        fewer points per block
+        constexpr size_t MAX_BATCH_REGISTERS = 1 << 20;
+        bool is_zero(Tangent val) {
+            return val.value == 0 && val.tangent == 0;
+        }
+    }
+
+    double Program::evaluate(double x) const {
+        check_only_x();
+        return evaluate(&x);
+    }
+    double Program::evaluate(const double* point) const {
+//        reused between calls so that evaluation does not allocate
+        thread_local vector<double> registers;
+        if (registers.size() < code_.size()) {
+            registers.resize(code_.size());
+        }
+        double* reg = registers.data();
+        for (size_t i = 0; i < code_.size(); i++) {
+            const Instruction& instr = code_[i];
+            switch (instr.code) {
+                case OpCode::CONST:
+                    reg[i] = constants_[instr.left];
+                    break;
+                case OpCode::VAR:
+                    reg[i] = point[instr.left];
+                    break;
+                case OpCode::SUM:
+                    reg[i] = reg[instr.left] + reg[instr.right];
+                    break;
+                case OpCode::DIFF:
+                    reg[i] = reg[instr.left] - reg[instr.right];
+                    break;
+                case OpCode::MULT:
+                    reg[i] = reg[instr.left] * reg[instr.right];
+                    break;
+                case OpCode::DIV:
+                    reg[i] = reg[instr.left] / reg[instr.right];
+                    break;
+                case OpCode::POW:
+                    reg[i] = std::pow(reg[instr.left], reg[instr.right]);
+                    break;
+                case OpCode::SIN:
+                    reg[i] = std::sin(reg[instr.left]);
+                    break;
+                case OpCode::COS:
+                    reg[i] = std::cos(reg[instr.left]);
+                    break;
+                case OpCode::TAN:
+                    reg[i] = std::tan(reg[instr.left]);
+                    break;
+                case OpCode::COT:
+                    reg[i] = 1 / std::tan(reg[instr.left]);
+                    break;
+                case OpCode::NEG:
+                    reg[i] = -reg[instr.left];
+                    break;
+                case OpCode::LN:
+                    reg[i] = std::log(reg[instr.left]);
+                    break;
+            }
+        }
+        return reg[code_.size() - 1];
+    }
+
+    void Program::evaluate_batch(const double* xs, double* out,
+                                 size_t n) const {
+        check_only_x();
+        size_t block = clamp<size_t>(MAX_BATCH_REGISTERS / code_.size(), 1,
+                                     Batch::BLOCK_SIZE);
+        thread_local vector<double> registers;
+        if (registers.size() < code_.size() * block) {
+            registers.resize(code_.size() * block);
+        }
+        for (size_t first = 0; first < n; first += block) {
+            size_t m = min(block, n - first);
+            auto reg = [&](uint32_t i) {
+                return registers.data() + i * block;
+            };
+            for (size_t i = 0; i < code_.size(); i++) {
+                const Instruction& instr = code_[i];
+                double* a = reg(instr.left);
+                double* b = reg(instr.right);
+                double* ret = reg(i);
+                switch (instr.code) {
+                    case OpCode::CONST:
+                        Batch::fill(constants_[instr.left], ret, m);
+                        break;
+                    case OpCode::VAR:
+                        Batch::copy(xs + first, ret, m);
+                        break;
+                    case OpCode::SUM:
+                        Batch::sum(a, b, ret, m);
+                        break;
+                    case OpCode::DIFF:
+                        Batch::diff(a, b, ret, m);
+                        break;
+                    case OpCode::MULT:
+                        Batch::mult(a, b, ret, m);
+                        break;
+                    case OpCode::DIV:
+                        Batch::div(a, b, ret, m);
+                        break;
+                    case OpCode::POW:
+                        Batch::pow(a, b, ret, m);
+                        break;
+                    case OpCode::SIN:
+                        Batch::sin(a, ret, m);
+                        break;
+                    case OpCode::COS:
+                        Batch::cos(a, ret, m);
+                        break;
+                    case OpCode::TAN:
+                        Batch::tan(a, ret, m);
+                        break;
+                    case OpCode::COT:
+                        Batch::cot(a, ret, m);
+                        break;
+                    case OpCode::NEG:
+                        Batch::neg(a, ret, m);
+                        break;
+                    case OpCode::LN:
+                        Batch::ln(a, ret, m);
+                        break;
+                }
+            }
+            Batch::copy(reg(code_.size() - 1), out + first, m);
+        }
+    }
+
+    Node::Dual Program::evaluate_dual(double x) const {
+        using namespace Node::UnaryFunc;
+        check_only_x();
+        thread_local vector<Node::Dual> registers;
+        if (registers.size() < code_.size()) {
+            registers.resize(code_.size());
+        }
+        Node::Dual* reg = registers.data();
+        for (size_t i = 0; i < code_.size(); i++) {
+            const Instruction& instr = code_[i];
+            Node::Dual a = reg[instr.left];
+            Node::Dual b = reg[instr.right];
+            switch (instr.code) {
+                case OpCode::CONST:
+                    reg[i] = {constants_[instr.left], 0};
+                    break;
+                case OpCode::VAR:
+                    reg[i] = {x, 1};
+                    break;
+                case OpCode::SUM:
+                    reg[i] = {a.value + b.value, a.derivative + b.derivative};
+                    break;
+                case OpCode::DIFF:
+                    reg[i] = {a.value - b.value, a.derivative - b.derivative};
+                    break;
+                case OpCode::MULT:
+                    reg[i] = {
+                        a.value * b.value,
+                        a.derivative * b.value + a.value * b.derivative
+                    };
+                    break;
+                case OpCode::DIV:
+                    reg[i] = {
+                        a.value / b.value,
+                        (a.derivative * b.value - a.value * b.derivative)
+                            / (b.value * b.value)
+                    };
+                    break;
+                case OpCode::POW: {
+                    double value = std::pow(a.value, b.value);
+                    if (b.derivative == 0) {
+//                        constant power, also defined for negative bases
+                        reg[i] = {
+                            value,
+                            a.derivative == 0
+                                ? 0
+                                : b.value * std::pow(a.value, b.value - 1)
+                                    * a.derivative
+                        };
+                    } else {
+                        reg[i] = {
+                            value,
+                            value * (a.derivative * b.value / a.value
+                                     + std::log(a.value) * b.derivative)
+                        };
+                    }
+                    break;
+                }
+                case OpCode::SIN:
+                    reg[i] = {Sin::apply(a.value),
+                              Sin::apply_derivative(a.value) * a.derivative};
+                    break;
+                case OpCode::COS:
+                    reg[i] = {Cos::apply(a.value),
+                              Cos::apply_derivative(a.value) * a.derivative};
+                    break;
+                case OpCode::TAN:
+                    reg[i] = {Tan::apply(a.value),
+                              Tan::apply_derivative(a.value) * a.derivative};
+                    break;
+                case OpCode::COT:
+                    reg[i] = {Cot::apply(a.value),
+                              Cot::apply_derivative(a.value) * a.derivative};
+                    break;
+                case OpCode::NEG:
+                    reg[i] = {Neg::apply(a.value),
+                              Neg::apply_derivative(a.value) * a.derivative};
+                    break;
+                case OpCode::LN:
+                    reg[i] = {Ln::apply(a.value),
+                              Ln::apply_derivative(a.value) * a.derivative};
+                    break;
+            }
+        }
+        return reg[code_.size() - 1];
+    }
+
+    Interval::Bounds Program::evaluate_interval(
+        const Interval::Bounds& x
+    ) const {
+        check_only_x();
+        thread_local vector<Interval::Bounds> registers;
+        if (registers.size() < code_.size()) {
+            registers.resize(code_.size());
+        }
+        Interval::Bounds* reg = registers.data();
+        for (size_t i = 0; i < code_.size(); i++) {
+            const Instruction& instr = code_[i];
+            const Interval::Bounds& a = reg[instr.left];
+            const Interval::Bounds& b = reg[instr.right];
+            switch (instr.code) {
+                case OpCode::CONST:
+                    reg[i] = Interval::point(constants_[instr.left]);
+                    break;
+                case OpCode::VAR:
+                    reg[i] = x;
+                    break;
+                case OpCode::SUM:
+                    reg[i] = Interval::sum(a, b);
+                    break;
+                case OpCode::DIFF:
+                    reg[i] = Interval::diff(a, b);
+                    break;
+                case OpCode::MULT:
+                    reg[i] = Interval::mult(a, b);
+                    break;
+                case OpCode::DIV:
+                    reg[i] = Interval::div(a, b);
+                    break;
+                case OpCode::POW:
+                    reg[i] = Interval::pow(a, b);
+                    break;
+                case OpCode::SIN:
+                    reg[i] = Interval::sin(a);
+                    break;
+                case OpCode::COS:
+                    reg[i] = Interval::cos(a);
+                    break;
+                case OpCode::TAN:
+                    reg[i] = Interval::tan(a);
+                    break;
+                case OpCode::COT:
+                    reg[i] = Interval::cot(a);
+                    break;
+                case OpCode::NEG:
+                    reg[i] = Interval::neg(a);
+                    break;
+                case OpCode::LN:
+                    reg[i] = Interval::ln(a);
+                    break;
+            }
+        }
+        return reg[code_.size() - 1];
+    }
+
+    template<typename T>
+    T Program::sweep(const T* point, T* grad) const {
+        using std::sin, std::cos, std::tan, std::log, std::pow;
+        thread_local vector<T> registers, adjoints;
+        if (registers.size() < code_.size()) {
+            registers.resize(code_.size());
+            adjoints.resize(code_.size());
+        }
+        T* reg = registers.data();
+        T* adj = adjoints.data();
+        for (size_t i = 0; i < code_.size(); i++) {
+            const Instruction& instr = code_[i];
+            adj[i] = lift<T>(0);
+            switch (instr.code) {
+                case OpCode::CONST:
+                    reg[i] = lift<T>(constants_[instr.left]);
+                    break;
+                case OpCode::VAR:
+                    reg[i] = point[instr.left];
+                    break;
+                case OpCode::SUM:
+                    reg[i] = reg[instr.left] + reg[instr.right];
+                    break;
+                case OpCode::DIFF:
+                    reg[i] = reg[instr.left] - reg[instr.right];
+                    break;
+                case OpCode::MULT:
+                    reg[i] = reg[instr.left] * reg[instr.right];
+                    break;
+                case OpCode::DIV:
+                    reg[i] = reg[instr.left] / reg[instr.right];
+                    break;
+                case OpCode::POW:
+                    reg[i] = pow(reg[instr.left], reg[instr.right]);
+                    break;
+                case OpCode::SIN:
+                    reg[i] = sin(reg[instr.left]);
+                    break;
+                case OpCode::COS:
+                    reg[i] = cos(reg[instr.left]);
+                    break;
+                case OpCode::TAN:
+                    reg[i] = tan(reg[instr.left]);
+                    break;
+                case OpCode::COT:
+                    reg[i] = lift<T>(1) / tan(reg[instr.left]);
+                    break;
+                case OpCode::NEG:
+                    reg[i] = -reg[instr.left];
+                    break;
+                case OpCode::LN:
+                    reg[i] = log(reg[instr.left]);
+                    break;
+            }
+        }
+        for (size_t slot = 0; slot < variables_.size(); slot++) {
+            grad[slot] = lift<T>(0);
+        }
+        adj[code_.size() - 1] = lift<T>(1);
+        for (size_t i = code_.size(); i-- > 0; ) {
+            const Instruction& instr = code_[i];
+            T a = adj[i];
+            if (is_zero(a)) {
+                continue;
+            }
+            T* left = adj + instr.left;
+            T* right = adj + instr.right;
+            switch (instr.code) {
+                case OpCode::CONST:
+                    break;
+                case OpCode::VAR:
+                    grad[instr.left] += a;
+                    break;
+                case OpCode::SUM:
+                    *left += a;
+                    *right += a;
+                    break;
+                case OpCode::DIFF:
+                    *left += a;
+                    *right -= a;
+                    break;
+                case OpCode::MULT:
+                    *left += a * reg[instr.right];
+                    *right += a * reg[instr.left];
+                    break;
+                case OpCode::DIV:
+                    *left += a / reg[instr.right];
+                    *right -= a * reg[i] / reg[instr.right];
+                    break;
+                case OpCode::POW:
+//                    constant operands are skipped, so that ln of a negative
+//                    base does not turn the result into NaN
+                    if (code_[instr.left].code != OpCode::CONST) {
+                        *left += a * reg[instr.right]
+                            * pow(reg[instr.left], reg[instr.right] - lift<T>(1));
+                    }
+                    if (code_[instr.right].code != OpCode::CONST) {
+                        *right += a * reg[i] * log(reg[instr.left]);
+                    }
+                    break;
+                case OpCode::SIN:
+                    *left += a * cos(reg[instr.left]);
+                    break;
+                case OpCode::COS:
+                    *left -= a * sin(reg[instr.left]);
+                    break;
+                case OpCode::TAN: {
+                    T c = cos(reg[instr.left]);
+                    *left += a / (c * c);
+                    break;
+                }
+                case OpCode::COT: {
+                    T s = sin(reg[instr.left]);
+                    *left -= a / (s * s);
+                    break;
+                }
+                case OpCode::NEG:
+                    *left -= a;
+                    break;
+                case OpCode::LN:
+                    *left += a / reg[instr.left];
+                    break;
+            }
+        }
+        return reg[code_.size() - 1];
+    }
+
+    double Program::gradient(const double* point, double* grad) const {
+        return sweep(point, grad);
+    }
+    double Program::hessian_vector(const double* point, const double* direction,
+                                   double* grad,
+                                   double* hessian_direction) const {
+        thread_local vector<Tangent> tangent_point, tangent_grad;
+        tangent_point.resize(variables_.size());
+        tangent_grad.resize(variables_.size());
+        for (size_t slot = 0; slot < variables_.size(); slot++) {
+            tangent_point[slot] = {point[slot], direction[slot]};
+        }
+        Tangent ret = sweep(tangent_point.data(), tangent_grad.data());
+        for (size_t slot = 0; slot < variables_.size(); slot++) {
+            grad[slot] = tangent_grad[slot].value;
+            hessian_direction[slot] = tangent_grad[slot].tangent;
+        }
+        return ret.value;
+    }
+    const vector<size_t>& Program::variables() const {
+        return variables_;
+    }
+    void Program::check_only_x() const {
+        for (size_t index : variables_) {
+            if (index != 0) {
+                throw invalid_argument("Expression depends on variables other "
+                                       "than x: " + Node::variable_name(index));
+            }
+        }
+    }
+    const vector<Instruction>& Program::code() const {
+        return code_;
+    }
+    const vector<double>& Program::constants() const {
+        return constants_;
+    }
+    size_t Program::size() const {
+        return code_.size();
+    }
+
+    uint32_t Compiler::compile(const Node::Base* node) {
+        if (auto it = registers_.find(node); it != registers_.end()) {
+            return it->second;
+        }
+        uint32_t reg = node->compile(*this);
+        registers_.emplace(node, reg);
+        return reg;
+    }
+
+    uint32_t Compiler::push(OpCode code, uint32_t left, uint32_t right) {
+        program_.code_.push_back({code, left, right});
+        return program_.code_.size() - 1;
+    }
+    uint32_t Compiler::push_constant(double val) {
+        program_.constants_.push_back(val);
+        return push(OpCode::CONST, program_.constants_.size() - 1, 0);
+    }
+    uint32_t Compiler::push_variable(size_t index) {
+        auto [it, inserted] = slots_.emplace(index,
+                                             program_.variables_.size());
+        if (inserted) {
+            program_.variables_.push_back(index);
+        }
+        return push(OpCode::VAR, it->second, 0);
+    }
+    uint32_t Compiler::push_binary_op(::BinaryOp::Type type,
+                                      uint32_t left, uint32_t right) {
+        switch (type) {
+            case ::BinaryOp::Type::SUM:
+                return push(OpCode::SUM, left, right);
+            case ::BinaryOp::Type::DIFF:
+                return push(OpCode::DIFF, left, right);
+            case ::BinaryOp::Type::MULT:
+                return push(OpCode::MULT, left, right);
+            case ::BinaryOp::Type::DIV:
+                return push(OpCode::DIV, left, right);
+            case ::BinaryOp::Type::POW:
+                return push(OpCode::POW, left, right);
+        }
+        throw logic_error("Unreachable code");
+    }
+    uint32_t Compiler::push_unary_func(::UnaryFunc func, uint32_t arg) {
+        switch (func) {
+            case ::UnaryFunc::SIN:
+                return push(OpCode::SIN, arg, 0);
+            case ::UnaryFunc::COS:
+                return push(OpCode::COS, arg, 0);
+            case ::UnaryFunc::TAN:
+                return push(OpCode::TAN, arg, 0);
+            case ::UnaryFunc::COT:
+                return push(OpCode::COT, arg, 0);
+            case ::UnaryFunc::NEG:
+                return push(OpCode::NEG, arg, 0);
+            case ::UnaryFunc::LN:
+                return push(OpCode::LN, arg, 0);
+        }
+        throw logic_error("Unreachable code");
+    }
+
+    Program Compiler::finish() {
+//        renumber slots in the order of variable names
+        vector<size_t>& variables = program_.variables_;
+        vector<uint32_t> order(variables.size());
+        iota(order.begin(), order.end(), 0);
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return Node::variable_name(variables[a])
+                < Node::variable_name(variables[b]);
+        });
+        vector<uint32_t> new_slot(variables.size());
+        vector<size_t> sorted;
+        for (uint32_t slot : order) {
+            new_slot[slot] = sorted.size();
+            sorted.push_back(variables[slot]);
+        }
+        for (Instruction& instr : program_.code_) {
+            if (instr.code == OpCode::VAR) {
+                instr.left = new_slot[instr.left];
+            }
+        }
+        variables = move(sorted);
+        registers_.clear();
+        slots_.clear();
+        return move(program_);
+    }
+
+    Program compile(const Node::Base* expr) {
+        Compiler compiler;
+        compiler.compile(expr);
+        return compiler.finish();
+    }
+}
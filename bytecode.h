@@ -0,0 +1,89 @@
+#pragma once
+
+#include "binary_operation.h"
+#include "expression_tree.h"
+#include "interval.h"
+#include "token.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Bytecode {
+    enum class OpCode : uint8_t {
+        CONST, VAR, SUM, DIFF, MULT, DIV, POW, SIN, COS, TAN, COT, NEG, LN
+    };
+
+//    every instruction writes the register equal to its own index;
+//    operands are registers of earlier instructions
+    struct Instruction {
+        OpCode code;
+//        for CONST, index into the constant pool; for VAR, variable slot
+        uint32_t left;
+        uint32_t right;
+    };
+
+//    flat program for a register machine; evaluates exactly the same
+//    operations as Node::Base::evaluate, but computes every shared node
+//    of a DAG once
+    class Program {
+    public:
+//        defined only for programs that depend on nothing but x
+        double evaluate(double x) const;
+//        point holds a value for every variable slot
+        double evaluate(const double* point) const;
+//        the same for every point of xs, block by block with the kernels
+//        of Batch
+        void evaluate_batch(const double* xs, double* out, size_t n) const;
+//        value and derivative by x in one forward sweep; functions are
+//        differentiated by their apply_derivative
+        Node::Dual evaluate_dual(double x) const;
+//        bounds of the value for x within x, as in Interval
+        Interval::Bounds evaluate_interval(const Interval::Bounds& x) const;
+//        reverse-mode sweep; writes the partial derivative for every slot
+//        to grad and returns the value
+        double gradient(const double* point, double* grad) const;
+//        forward-over-reverse sweep; additionally writes the product of the
+//        Hessian and direction to hessian_direction
+        double hessian_vector(const double* point, const double* direction,
+                              double* grad, double* hessian_direction) const;
+//        global variable indices, one per slot, ordered by name
+        const std::vector<size_t>& variables() const;
+//        throws unless the only variable the program may depend on is x
+        void check_only_x() const;
+        const std::vector<Instruction>& code() const;
+        const std::vector<double>& constants() const;
+        size_t size() const;
+    private:
+        friend class Compiler;
+        std::vector<Instruction> code_;
+        std::vector<double> constants_;
+        std::vector<size_t> variables_;
+
+        template<typename T>
+        T sweep(const T* point, T* grad) const;
+    };
+
+    class Compiler {
+    public:
+//        returns the register holding the value of node, compiling it once
+        uint32_t compile(const Node::Base* node);
+
+        uint32_t push_constant(double val);
+        uint32_t push_variable(size_t index);
+        uint32_t push_binary_op(::BinaryOp::Type type,
+                                uint32_t left, uint32_t right);
+        uint32_t push_unary_func(::UnaryFunc func, uint32_t arg);
+
+        Program finish();
+    private:
+        Program program_;
+        std::unordered_map<const Node::Base*, uint32_t> registers_;
+//        slot of every global variable index used so far
+        std::unordered_map<size_t, uint32_t> slots_;
+
+        uint32_t push(OpCode code, uint32_t left, uint32_t right);
+    };
+
+    Program compile(const Node::Base* expr);
+}
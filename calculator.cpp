@@ -1,32 +1,437 @@
 #include "calculator.h"
 #include "expression.h"
+#include "simplify.h"
+#include "stats.h"
+
+#include <algorithm>
 
 using namespace std;
 
-void Calculator::new_expr(shared_ptr<Node::Base> expr) {
-    last_ = move(expr);
+namespace {
+    atomic<uint64_t> next_id{1};
+}
+
+Calculator::Calculator(shared_ptr<EvalCache> eval_cache,
+                       shared_ptr<DerivativeStore> store)
+: state_(make_shared<const State>(
+      State{nullptr, nullptr, make_shared<const Vars>(), nullptr, 0}
+  )),
+  id_(next_id++), eval_cache_(move(eval_cache)), store_(move(store)) {}
+Calculator::Calculator(const Calculator& other)
+: state_(atomic_load(&other.state_)), id_(next_id++),
+  eval_cache_(other.eval_cache_), store_(other.store_) {}
+
+void Calculator::new_expr(Node::Ptr expr) {
+    auto program = compile_program(expr);
+    update([&](State& state) {
+        state.last = move(expr);
+        state.last_program = move(program);
+        state.last_source = nullptr;
+    });
 }
 void Calculator::save(const string& name) {
-    vars_[name] = last_;
+//    compiled without the lock, from a snapshot, and published only if
+//    nothing changed meanwhile
+    while (true) {
+        uint64_t version;
+        auto current = snapshot(version);
+        auto expr = make_shared<const Expression>(
+            make_expression(current->last)
+        );
+        bool done = update_if(version, [&](State& state) {
+            set_var(state, name, expr);
+            state.last_source = expr;
+            state.last_order = 0;
+        });
+        if (done) {
+            return;
+        }
+    }
+}
+void Calculator::compile(const string& name) {
+    auto current = state().vars->at(name);
+    Expression expr = *current;
+    Bytecode::Program der = Bytecode::compile(derivative(expr, 1).get());
+    expr.native = Jit::compile({expr.program.get(), &der}, expr.tree->hash());
+    update([&](State& state) {
+//        dropped if <name> was saved again while compiling
+        if (state.vars->at(name) == current) {
+            set_var(state, name, move(expr));
+        }
+    });
+}
+Node::Ptr Calculator::derivative() {
+//    computed without the lock, from a snapshot, and published only if
+//    nothing changed meanwhile, so that readers and other writers never
+//    wait for it
+    while (true) {
+        uint64_t version;
+        auto current = snapshot(version);
+        size_t order = current->last_order + 1;
+        Node::Ptr ret;
+        if (current->last_source != nullptr) {
+            ret = derivative(*current->last_source, order);
+        } else {
+            Stats::derivative_cache().misses++;
+            Node::DerivativeCache cache;
+            ret = next_order(current->last, 1, current->last, cache).canonical;
+        }
+        auto program = compile_program(ret);
+        bool done = update_if(version, [&](State& state) {
+            state.last = ret;
+            state.last_program = move(program);
+            state.last_order = order;
+        });
+        if (done) {
+            return ret;
+        }
+    }
+}
+Node::Ptr Calculator::derivative(const string& name) {
+    return derivative(name, 1);
+}
+Node::Ptr Calculator::derivative(const string& name, size_t order) {
+    shared_ptr<const Expression> expr = state().vars->at(name);
+    Node::Ptr ret = derivative(*expr, order);
+    set_last(ret, move(expr), order);
+    return ret;
+}
+Calculator::Expression Calculator::make_expression(Node::Ptr tree) {
+    auto program = compile_program(tree);
+    return {EvalCache::new_id(), move(tree), move(program),
+            make_shared<Derivatives>(), nullptr};
+}
+Node::Ptr Calculator::derivative(const Expression& expr,
+                                 size_t order) const {
+    if (order == 0) {
+        return expr.tree;
+    }
+    Derivatives& ders = *expr.derivatives;
+    lock_guard lock(ders.mtx);
+    auto& counters = Stats::derivative_cache();
+    (ders.orders.size() >= order ? counters.hits : counters.misses)++;
+    while (ders.orders.size() < order) {
+        const Node::Ptr& prev = ders.raw_orders.empty()
+            ? expr.tree
+            : ders.raw_orders.back();
+        auto [raw, canonical] = next_order(expr.tree, ders.orders.size() + 1,
+                                           prev, ders.cache);
+        ders.raw_orders.push_back(move(raw));
+        ders.orders.push_back(move(canonical));
+    }
+    return ders.orders[order - 1];
 }
-shared_ptr<Node::Base> Calculator::derivative() {
-    return last_ = ::derivative(last_.get());
+DerivativeStore::Entry Calculator::next_order(
+    const Node::Ptr& tree, size_t order, const Node::Ptr& prev,
+    Node::DerivativeCache& cache
+) const {
+    DerivativeStore::Entry ret;
+    if (store_ != nullptr) {
+        auto& counters = Stats::derivative_store();
+        if (store_->find(tree, order, ret)) {
+            counters.hits++;
+            return ret;
+        }
+        counters.misses++;
+    }
+    {
+        Stats::Timer timer(Stats::Stage::DERIVE);
+        ret.raw = prev->derivative(cache);
+    }
+    {
+        Stats::Timer timer(Stats::Stage::SIMPLIFY);
+        ret.canonical = canonicalize(ret.raw);
+    }
+    if (store_ != nullptr) {
+        store_->insert(tree, order, ret);
+    }
+    return ret;
 }
-shared_ptr<Node::Base> Calculator::derivative(const string& name) {
-    return last_ = ::derivative(vars_.at(name).get());
+vector<ExpressionSize> Calculator::derivative_sizes(const string& name) const {
+    const Expression& expr = var(name);
+    vector<ExpressionSize> ret = {expression_size(expr.tree.get())};
+    lock_guard lock(expr.derivatives->mtx);
+    for (const Node::Ptr& der : expr.derivatives->orders) {
+        ret.push_back(expression_size(der.get()));
+    }
+    return ret;
+}
+vector<pair<string, Footprint>> Calculator::footprints() const {
+    vector<pair<string, Footprint>> ret;
+    for (const auto& [name, expr] : *state().vars) {
+        vector<const Node::Base*> roots = {expr->tree.get()};
+        lock_guard lock(expr->derivatives->mtx);
+        for (const auto* orders : {&expr->derivatives->orders,
+                                   &expr->derivatives->raw_orders}) {
+            for (const Node::Ptr& der : *orders) {
+                roots.push_back(der.get());
+            }
+        }
+        ret.emplace_back(name, footprint(roots));
+    }
+    sort(ret.begin(), ret.end(), [](auto& a, auto& b) {
+        return a.first < b.first;
+    });
+    return ret;
 }
 double Calculator::evaluate(double x) const {
-    return last_->evaluate(x);
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return state().last_program->evaluate(x);
 }
 double Calculator::evaluate(const string& name, double x) const {
-    return vars_.at(name)->evaluate(x);
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    const Expression& expr = var(name);
+    if (eval_cache_ == nullptr) {
+        return evaluate_uncached(expr, x);
+    }
+    auto& counters = Stats::eval_cache();
+    double ret;
+    if (eval_cache_->find(expr.id, x, ret)) {
+        counters.hits++;
+        return ret;
+    }
+    counters.misses++;
+    ret = evaluate_uncached(expr, x);
+    eval_cache_->insert(expr.id, x, ret);
+    return ret;
+}
+double Calculator::evaluate_uncached(const Expression& expr, double x) {
+    if (expr.native != nullptr) {
+        expr.program->check_only_x();
+        return expr.native->get(0)(&x);
+    }
+    return expr.program->evaluate(x);
+}
+Node::Dual Calculator::evaluate_dual(double x) const {
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return state().last_program->evaluate_dual(x);
+}
+Node::Dual Calculator::evaluate_dual(const string& name, double x) const {
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    const Expression& expr = var(name);
+    if (expr.native != nullptr) {
+        expr.program->check_only_x();
+        return {expr.native->get(0)(&x), expr.native->get(1)(&x)};
+    }
+    return expr.program->evaluate_dual(x);
+}
+void Calculator::evaluate_batch(const double* xs, double* out,
+                                size_t n) const {
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    state().last_program->evaluate_batch(xs, out, n);
+}
+void Calculator::evaluate_batch(const string& name,
+                                const double* xs, double* out,
+                                size_t n) const {
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    const Expression& expr = var(name);
+    if (eval_cache_ == nullptr) {
+        evaluate_batch_uncached(expr, xs, out, n);
+        return;
+    }
+//    points that miss are evaluated together, then stored
+    vector<size_t> missed;
+    vector<double> missed_xs;
+    for (size_t i = 0; i < n; i++) {
+        if (!eval_cache_->find(expr.id, xs[i], out[i])) {
+            missed.push_back(i);
+            missed_xs.push_back(xs[i]);
+        }
+    }
+    auto& counters = Stats::eval_cache();
+    counters.hits += n - missed.size();
+    counters.misses += missed.size();
+    if (missed.empty()) {
+        return;
+    }
+    vector<double> results(missed.size());
+    evaluate_batch_uncached(expr, missed_xs.data(), results.data(),
+                            missed.size());
+    for (size_t i = 0; i < missed.size(); i++) {
+        out[missed[i]] = results[i];
+        eval_cache_->insert(expr.id, missed_xs[i], results[i]);
+    }
+}
+void Calculator::evaluate_batch_uncached(const Expression& expr,
+                                         const double* xs, double* out,
+                                         size_t n) {
+    if (expr.native != nullptr) {
+        expr.program->check_only_x();
+        Jit::Function f = expr.native->get(0);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = f(xs + i);
+        }
+        return;
+    }
+    expr.program->evaluate_batch(xs, out, n);
+}
+Interval::Bounds Calculator::range(double a, double b) const {
+    const State& current = state();
+    auto program = current.last_program;
+    Bytecode::Program der = Bytecode::compile(
+        ::derivative(current.last.get()).get()
+    );
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return ::range(*program, der, a, b);
+}
+Interval::Bounds Calculator::range(const string& name,
+                                   double a, double b) const {
+    auto expr = state().vars->at(name);
+    Bytecode::Program der = Bytecode::compile(derivative(*expr, 1).get());
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return ::range(*expr->program, der, a, b);
 }
-shared_ptr<Node::Base> Calculator::get() {
-    return last_;
+vector<Root> Calculator::roots(double a, double b) const {
+    const State& current = state();
+    auto program = current.last_program;
+    Bytecode::Program der = Bytecode::compile(
+        ::derivative(current.last.get()).get()
+    );
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return ::roots(*program, der, a, b);
 }
-shared_ptr<Node::Base> Calculator::get(const string& name) {
-    return last_ = vars_.at(name);
+vector<Root> Calculator::roots(const string& name, double a, double b) const {
+    auto expr = state().vars->at(name);
+    Bytecode::Program der = Bytecode::compile(derivative(*expr, 1).get());
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return ::roots(*expr->program, der, a, b);
+}
+Integral Calculator::integrate(double a, double b, double tolerance) const {
+    auto program = state().last_program;
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return ::integrate(*program, a, b, tolerance);
+}
+Integral Calculator::integrate(const string& name, double a, double b,
+                               double tolerance) const {
+    auto expr = state().vars->at(name);
+    Stats::Timer timer(Stats::Stage::EVALUATE);
+    return ::integrate(*expr->program, a, b, tolerance);
+}
+shared_ptr<const Bytecode::Program> Calculator::program() const {
+    return state().last_program;
+}
+shared_ptr<const Bytecode::Program> Calculator::program(
+    const string& name
+) const {
+    return var(name).program;
+}
+Node::Ptr Calculator::get() {
+    return state().last;
+}
+Node::Ptr Calculator::get(const string& name) {
+    shared_ptr<const Expression> expr = state().vars->at(name);
+    Node::Ptr ret = expr->tree;
+    set_last(ret, move(expr), 0);
+    return ret;
 }
 bool Calculator::var_exists(const string& name) const {
-    return vars_.find(name) != vars_.end();
+    const Vars& vars = *state().vars;
+    return vars.find(name) != vars.end();
+}
+Serialize::Session Calculator::session() const {
+    const State& current = state();
+    Serialize::Session ret{current.last, {}};
+    for (const auto& [name, expr] : *current.vars) {
+        ret.vars.emplace_back(name, expr->tree);
+    }
+    sort(ret.vars.begin(), ret.vars.end(), [](auto& a, auto& b) {
+        return a.first < b.first;
+    });
+    return ret;
+}
+void Calculator::restore(const Serialize::Session& session) {
+//    compiled before taking the lock, like COMPILE
+    vector<pair<string, Expression>> exprs;
+    for (const auto& [name, tree] : session.vars) {
+        exprs.emplace_back(name, make_expression(tree));
+    }
+    auto last_program = compile_program(session.last);
+    update([&](State& state) {
+        if (session.last != nullptr) {
+            state.last = session.last;
+            state.last_program = last_program;
+            state.last_source = nullptr;
+        }
+        for (auto& [name, expr] : exprs) {
+            set_var(state, name, move(expr));
+        }
+    });
+}
+
+const Calculator::State& Calculator::state() const {
+//    the version last seen by this thread; while it is current, reading
+//    touches neither a lock nor a shared reference count
+    thread_local struct {
+        uint64_t id = 0;
+        uint64_t version = 0;
+        shared_ptr<const State> state;
+    } cache;
+    uint64_t version = version_.load(memory_order_acquire);
+    if (cache.id != id_ || cache.version != version) {
+        cache.state = atomic_load(&state_);
+        cache.id = id_;
+        cache.version = version;
+    }
+    return *cache.state;
+}
+const Calculator::Expression& Calculator::var(const string& name) const {
+    return *state().vars->at(name);
+}
+shared_ptr<const Calculator::State> Calculator::snapshot(
+    uint64_t& version
+) const {
+//    the version is read first, so a change between the reads makes the
+//    pair stale rather than unnoticed
+    version = version_.load(memory_order_acquire);
+    return atomic_load(&state_);
+}
+template<typename F>
+void Calculator::update(F change) {
+    lock_guard lock(write_mtx_);
+    publish(change);
+}
+template<typename F>
+bool Calculator::update_if(uint64_t version, F change) {
+    lock_guard lock(write_mtx_);
+    if (version_.load(memory_order_relaxed) != version) {
+        return false;
+    }
+    publish(change);
+    return true;
+}
+template<typename F>
+void Calculator::publish(F& change) {
+    auto next = make_shared<State>(*atomic_load(&state_));
+    change(*next);
+    atomic_store(&state_, shared_ptr<const State>(move(next)));
+    version_.fetch_add(1, memory_order_release);
+}
+void Calculator::set_last(Node::Ptr last,
+                          shared_ptr<const Expression> source, size_t order) {
+    auto program = order == 0 ? source->program : compile_program(last);
+    update([&](State& state) {
+        state.last = move(last);
+        state.last_program = move(program);
+        state.last_source = move(source);
+        state.last_order = order;
+    });
+}
+void Calculator::set_var(State& state, const string& name, Expression expr) {
+    set_var(state, name, make_shared<const Expression>(move(expr)));
+}
+void Calculator::set_var(State& state, const string& name,
+                         shared_ptr<const Expression> expr) {
+    auto vars = make_shared<Vars>(*state.vars);
+    (*vars)[name] = move(expr);
+    state.vars = move(vars);
+}
+shared_ptr<const Bytecode::Program> Calculator::compile_program(
+    const Node::Ptr& tree
+) {
+    if (tree == nullptr) {
+        return nullptr;
+    }
+    return make_shared<const Bytecode::Program>(
+        Bytecode::compile(tree.get())
+    );
 }
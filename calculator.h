@@ -1,21 +1,168 @@
 #pragma once
 
 #include "expression_tree.h"
+#include "expression.h"
+#include "bytecode.h"
+#include "derivative_store.h"
+#include "eval_cache.h"
+#include "integrate.h"
+#include "jit.h"
+#include "range.h"
+#include "roots.h"
+#include "serialize.h"
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
+//    safe to share between threads: state is an immutable version replaced
+//    atomically by every change, so reading methods never lock; copies are
+//    snapshots that share saved expressions and are independent afterwards
 class Calculator {
 public:
-    void new_expr(std::shared_ptr<Node::Base> expr);
+//    evaluations of saved expressions at points go through eval_cache and
+//    derivatives through store if they are given; both may be shared by
+//    any calculators
+    explicit Calculator(std::shared_ptr<EvalCache> eval_cache = nullptr,
+                        std::shared_ptr<DerivativeStore> store = nullptr);
+    Calculator(const Calculator& other);
+    Calculator& operator=(const Calculator&) = delete;
+
+    void new_expr(Node::Ptr expr);
     void save(const std::string& name);
-    std::shared_ptr<Node::Base> derivative();
-    std::shared_ptr<Node::Base> derivative(const std::string& name);
+//    builds native code for <name> and its derivative, which is then used
+//    by evaluation of <name>
+    void compile(const std::string& name);
+    Node::Ptr derivative();
+    Node::Ptr derivative(const std::string& name);
+//    derivative of the given order; every intermediate order is cached
+//    until <name> is saved again
+    Node::Ptr derivative(const std::string& name, size_t order);
+//    sizes of the expression <name> and of its cached derivatives
+    std::vector<ExpressionSize> derivative_sizes(const std::string& name) const;
+//    nodes held by every saved expression with its cached derivatives,
+//    by name
+    std::vector<std::pair<std::string, Footprint>> footprints() const;
     double evaluate(double x) const;
     double evaluate(const std::string& name, double x) const;
-    std::shared_ptr<Node::Base> get();
-    std::shared_ptr<Node::Base> get(const std::string& name);
+    Node::Dual evaluate_dual(double x) const;
+    Node::Dual evaluate_dual(const std::string& name, double x) const;
+    void evaluate_batch(const double* xs, double* out, size_t n) const;
+    void evaluate_batch(const std::string& name,
+                        const double* xs, double* out, size_t n) const;
+//    bounds of the values of the last expression or of <name> for x in
+//    [a, b]
+    Interval::Bounds range(double a, double b) const;
+    Interval::Bounds range(const std::string& name, double a, double b) const;
+//    roots of the last expression or of <name> in [a, b]
+    std::vector<Root> roots(double a, double b) const;
+    std::vector<Root> roots(const std::string& name, double a, double b) const;
+//    integral of the last expression or of <name> from a to b
+    Integral integrate(double a, double b, double tolerance) const;
+    Integral integrate(const std::string& name, double a, double b,
+                       double tolerance) const;
+//    compiled form of the last expression or of <name>, which evaluates at
+//    points with any set of variables
+    std::shared_ptr<const Bytecode::Program> program() const;
+    std::shared_ptr<const Bytecode::Program> program(
+        const std::string& name
+    ) const;
+    Node::Ptr get();
+    Node::Ptr get(const std::string& name);
     bool var_exists(const std::string& name) const;
+//    the last expression and every saved expression, sorted by name
+    Serialize::Session session() const;
+//    makes the last expression of session the last one, if it has one, and
+//    saves every expression of it as SAVE does; other names are kept
+    void restore(const Serialize::Session& session);
 private:
-    std::shared_ptr<Node::Base> last_;
-    std::unordered_map<std::string, std::shared_ptr<Node::Base>> vars_;
+//    derivatives of a saved expression, shared by all its versions
+    struct Derivatives {
+        std::mutex mtx;
+//        orders[k] is the derivative of order k + 1
+        std::vector<Node::Ptr> orders;
+//        the same before canonicalization; next orders are taken from
+//        these, which grow much slower than derivatives of canonical forms
+        std::vector<Node::Ptr> raw_orders;
+//        shared by all orders, so that derivatives of common subexpressions
+//        are reused
+        Node::DerivativeCache cache;
+    };
+//    saved tree together with its compiled form used for evaluation;
+//    immutable once saved, changes publish a new version
+    struct Expression {
+//        key in the evaluation cache; a new one for every save
+        uint64_t id;
+        Node::Ptr tree;
+        std::shared_ptr<const Bytecode::Program> program;
+        std::shared_ptr<Derivatives> derivatives;
+//        f0 evaluates the tree and f1 its first derivative; null unless
+//        compiled
+        std::shared_ptr<const Jit::Library> native;
+    };
+    using Vars = std::unordered_map<std::string,
+                                    std::shared_ptr<const Expression>>;
+    struct State {
+        Node::Ptr last;
+//        compiled form of last, by which it is evaluated; null if last is
+//        null
+        std::shared_ptr<const Bytecode::Program> last_program;
+//        shared between versions that differ only in last
+        std::shared_ptr<const Vars> vars;
+//        if set, last is the derivative of order last_order of last_source,
+//        so DER of last continues from its derivative cache
+        std::shared_ptr<const Expression> last_source;
+        size_t last_order = 0;
+    };
+    
+    static Expression make_expression(Node::Ptr tree);
+    Node::Ptr derivative(const Expression& expr, size_t order) const;
+//    derivative of order of tree from prev, its derivative of the order
+//    before, looked up in the store first
+    DerivativeStore::Entry next_order(const Node::Ptr& tree, size_t order,
+                                      const Node::Ptr& prev,
+                                      Node::DerivativeCache& cache) const;
+//    current version; valid until the next call on this thread
+    const State& state() const;
+    const Expression& var(const std::string& name) const;
+//    current version and the version_ it was read at
+    std::shared_ptr<const State> snapshot(uint64_t& version) const;
+//    publishes the version made by change from a copy of the current one
+    template<typename F>
+    void update(F change);
+//    the same, unless a change was published since snapshot returned
+//    version; work done before from the snapshot is then redone by the
+//    caller
+    template<typename F>
+    bool update_if(uint64_t version, F change);
+//    with write_mtx_ held
+    template<typename F>
+    void publish(F& change);
+    void set_last(Node::Ptr last, std::shared_ptr<const Expression> source,
+                  size_t order);
+    static std::shared_ptr<const Bytecode::Program> compile_program(
+        const Node::Ptr& tree
+    );
+    void set_var(State& state, const std::string& name, Expression expr);
+    void set_var(State& state, const std::string& name,
+                 std::shared_ptr<const Expression> expr);
+    static double evaluate_uncached(const Expression& expr, double x);
+    static void evaluate_batch_uncached(const Expression& expr,
+                                        const double* xs, double* out,
+                                        size_t n);
+
+//    read and written with atomic_load and atomic_store
+    std::shared_ptr<const State> state_;
+//    incremented after every change, so readers know when the version
+//    cached by their thread is stale
+    std::atomic<uint64_t> version_{0};
+//    distinguishes calculators in the per-thread cache
+    const uint64_t id_;
+    std::mutex write_mtx_;
+    std::shared_ptr<EvalCache> eval_cache_;
+    std::shared_ptr<DerivativeStore> store_;
 };
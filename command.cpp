@@ -0,0 +1,701 @@
+#include "command.h"
+#include "arena.h"
+#include "expression_tree.h"
+#include "expression.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+namespace {
+//    of INTEGRATE, relative to the integral
+    constexpr double DEFAULT_TOLERANCE = 1e-10;
+
+//    node memory of a command, kept per thread: the figures of the last
+//    finished command are exact as long as the thread runs commands alone
+    struct CommandMemory {
+        uint64_t start_bytes = 0;
+        uint64_t peak_bytes = 0;
+        array<uint64_t, Node::KIND_COUNT> created{};
+    };
+    thread_local CommandMemory current_command;
+    thread_local CommandMemory last_command;
+
+    array<uint64_t, Node::KIND_COUNT> created_nodes() {
+        array<uint64_t, Node::KIND_COUNT> ret;
+        for (size_t i = 0; i < Node::KIND_COUNT; i++) {
+            ret[i] = Node::kind_counters(static_cast<Node::Kind>(i))
+                .created.load(memory_order_relaxed);
+        }
+        return ret;
+    }
+
+//    closes the figures of the previous command on this thread and resets
+//    the peak for the next one
+    void begin_command() {
+        last_command.start_bytes = current_command.start_bytes;
+        last_command.peak_bytes = Node::peak_bytes();
+        array<uint64_t, Node::KIND_COUNT> created = created_nodes();
+        for (size_t i = 0; i < Node::KIND_COUNT; i++) {
+            last_command.created[i] = created[i]
+                - current_command.created[i];
+        }
+        current_command.start_bytes = Node::live_bytes();
+        current_command.created = created;
+        Node::reset_peak();
+    }
+
+    void print_memstats(const Calculator& calc, ostream& out) {
+        out << "live: " << Node::live_bytes() << " bytes\n"
+            << "held: " << Arena::chunk_bytes()
+            << " bytes in arena chunks\n"
+            << "last command: peak " << last_command.peak_bytes
+            << " bytes, " << last_command.start_bytes << " at start\n";
+        for (size_t i = 0; i < Node::KIND_COUNT; i++) {
+            auto kind = static_cast<Node::Kind>(i);
+            const Node::KindCounters& counters = Node::kind_counters(kind);
+            int64_t live = counters.live.load(memory_order_relaxed);
+            out << Node::kind_name(kind) << ": " << live << " live, "
+                << live * Node::node_bytes(kind) << " bytes, "
+                << counters.created.load(memory_order_relaxed)
+                << " created, "
+                << counters.reused.load(memory_order_relaxed)
+                << " reused, " << last_command.created[i]
+                << " created by last command\n";
+        }
+        for (const auto& [name, footprint] : calc.footprints()) {
+            out << name << ": " << footprint.nodes << " nodes, "
+                << footprint.bytes << " bytes\n";
+        }
+    }
+
+    bool is_space(char c) {
+        return isspace(static_cast<unsigned char>(c));
+    }
+    bool is_alpha(char c) {
+        return isalpha(static_cast<unsigned char>(c));
+    }
+    bool is_digit(char c) {
+        return isdigit(static_cast<unsigned char>(c));
+    }
+
+//    cursor over the whitespace-separated arguments of a command line
+    class Args {
+    public:
+        explicit Args(string_view line) : rest_(line) {
+            skip_spaces();
+        }
+
+        bool eof() const {
+            return rest_.empty();
+        }
+//        '\0' at the end, which no check for a letter or digit accepts
+        char peek() const {
+            return rest_.empty() ? '\0' : rest_[0];
+        }
+        void skip(size_t n) {
+            rest_.remove_prefix(n);
+            skip_spaces();
+        }
+        string_view word() {
+            size_t len = 0;
+            while (len < rest_.size() && !is_space(rest_[len])) {
+                len++;
+            }
+            string_view ret = rest_.substr(0, len);
+            skip(len);
+            return ret;
+        }
+        string_view rest() const {
+            return rest_;
+        }
+        template<typename T>
+        from_chars_result parse(T& val) {
+            auto ret = from_chars(rest_.data(), rest_.data() + rest_.size(),
+                                  val);
+            rest_.remove_prefix(ret.ptr - rest_.data());
+            return ret;
+        }
+    private:
+        string_view rest_;
+
+        void skip_spaces() {
+            while (!rest_.empty() && is_space(rest_[0])) {
+                rest_.remove_prefix(1);
+            }
+        }
+    };
+
+    string read_and_validate_new_var(Args& in) {
+        if (in.eof()) {
+            throw invalid_argument("Variable name must not be empty");
+        }
+        string_view name = in.word();
+        if (!in.eof()) {
+            throw invalid_argument("Variable name must not contain spaces");
+        }
+        if (!is_saved_name(name)) {
+            throw invalid_argument("Variable name must start with a letter");
+        }
+        return string(name);
+    }
+
+    optional<string> read_and_validate_existing_var(
+        Args& in, const Calculator& calc
+    ) {
+        if (in.eof()) {
+            return nullopt;
+        }
+        string name(in.word());
+        if (!in.eof()) {
+            throw invalid_argument("Variable name must not contain spaces");
+        }
+        if (!calc.var_exists(name)) {
+            throw invalid_argument("No variable with name: " + name);
+        }
+        return name;
+    }
+
+    size_t read_order(Args& in) {
+        size_t order;
+        if (!is_digit(in.peek()) || in.parse(order).ec != errc()) {
+            throw invalid_argument("Order must be a non-negative integer");
+        }
+        if (!in.eof()) {
+            throw invalid_argument("Invalid query");
+        }
+        return order;
+    }
+
+//    path of the file a command names, checked against files
+    string file_path(const string& name, const FileAccess& files) {
+        if (!files.restricted) {
+            return name;
+        }
+        if (files.root.empty()) {
+            throw invalid_argument("File access is disabled");
+        }
+        fs::path path(name);
+        if (path.is_absolute()
+            || find(path.begin(), path.end(), "..") != path.end()) {
+            throw invalid_argument(
+                "File name must be a relative path without .."
+            );
+        }
+        return (fs::path(files.root) / path).string();
+    }
+
+//    reads either a list of real numbers or @<file> with whitespace-separated
+//    real numbers
+    vector<double> read_points(Args& in, const FileAccess& files) {
+        vector<double> ret;
+        if (in.peek() == '@') {
+            in.skip(1);
+            string path(in.word());
+            if (path.empty() || !in.eof()) {
+                throw invalid_argument("Invalid query");
+            }
+            ifstream file(file_path(path, files));
+            if (!file) {
+                throw invalid_argument("Cannot open file: " + path);
+            }
+            for (double x; file >> x; ) {
+                ret.push_back(x);
+            }
+            if (!file.eof()) {
+                throw invalid_argument("Invalid number in file: " + path);
+            }
+            if (ret.empty()) {
+                throw invalid_argument("No points in file: " + path);
+            }
+            return ret;
+        }
+        while (!in.eof()) {
+            double x;
+            if (!is_digit(in.peek()) || in.parse(x).ec != errc()) {
+                throw invalid_argument("Invalid query");
+            }
+            if (!in.eof() && in.peek() != ' ') {
+                throw invalid_argument(
+                    "Variable name must not start with a digit"
+                );
+            }
+            in.skip(0);
+            ret.push_back(x);
+        }
+        if (ret.empty()) {
+            throw invalid_argument("Invalid query");
+        }
+        return ret;
+    }
+
+//    reads a real number, which unlike points may be negative
+    double read_number(Args& in) {
+        double ret;
+        if ((!is_digit(in.peek()) && in.peek() != '-')
+            || in.parse(ret).ec != errc()
+            || (!in.eof() && !is_space(in.peek()))) {
+            throw invalid_argument("Invalid query");
+        }
+        in.skip(0);
+        return ret;
+    }
+
+//    reads the name of a saved expression if the arguments start with one
+    optional<string> read_optional_var(Args& in, const Calculator& calc) {
+        if (!is_alpha(in.peek())) {
+            return nullopt;
+        }
+        Args copy = in;
+        string name(copy.word());
+        if (name.find('=') != string::npos) {
+            return nullopt;
+        }
+        in = copy;
+        if (!calc.var_exists(name)) {
+            throw invalid_argument("No variable with name: " + name);
+        }
+        return name;
+    }
+
+//    reads assignments <var>=<value> into a point with a value for every
+//    variable slot of program; variables without an assignment are set to
+//    default_value, or are an error if there is none
+    vector<double> read_assignments(Args in, const Bytecode::Program& program,
+                                    optional<double> default_value = nullopt) {
+        const vector<size_t>& variables = program.variables();
+        vector<optional<double>> values(variables.size());
+        while (!in.eof()) {
+            string_view assignment = in.word();
+            size_t eq = assignment.find('=');
+            if (eq == string_view::npos || eq == 0 || !is_alpha(assignment[0])) {
+                throw invalid_argument("Invalid query");
+            }
+            string_view var = assignment.substr(0, eq);
+            string_view value = assignment.substr(eq + 1);
+            if (!value.empty() && value[0] == '+') {
+                value.remove_prefix(1);
+            }
+            double val;
+            auto [end, ec] = from_chars(value.data(),
+                                        value.data() + value.size(), val);
+            if (value.empty() || ec != errc()
+                || end != value.data() + value.size()) {
+                throw invalid_argument("Invalid value of variable: "
+                                       + string(var));
+            }
+            auto it = find_if(variables.begin(), variables.end(),
+                              [&](size_t index) {
+                return Node::variable_name(index) == var;
+            });
+            if (it == variables.end()) {
+                throw invalid_argument("Expression does not depend on "
+                                       "variable: " + string(var));
+            }
+            optional<double>& slot = values[it - variables.begin()];
+            if (slot.has_value()) {
+                throw invalid_argument("Variable assigned twice: "
+                                       + string(var));
+            }
+            slot = val;
+        }
+        vector<double> ret(variables.size());
+        for (size_t slot = 0; slot < variables.size(); slot++) {
+            if (!values[slot].has_value() && !default_value.has_value()) {
+                throw invalid_argument("No value for variable: "
+                                       + Node::variable_name(variables[slot]));
+            }
+            ret[slot] = values[slot].value_or(default_value.value_or(0));
+        }
+        return ret;
+    }
+
+    string read_file_name(Args& in) {
+        if (in.eof()) {
+            throw invalid_argument("Enter file name");
+        }
+        string ret(in.word());
+        if (!in.eof()) {
+            throw invalid_argument("File name must not contain spaces");
+        }
+        return ret;
+    }
+
+    string read_command(Args& in) {
+        string ret(in.word());
+        transform(ret.begin(), ret.end(), ret.begin(), [](char c) {
+            return toupper(static_cast<unsigned char>(c));
+        });
+        return ret;
+    }
+
+    void print_expr(ostream& out, const Node::Ptr& expr) {
+        Stats::Timer timer(Stats::Stage::PRINT);
+        out << expr.get() << '\n';
+    }
+
+    void execute_or_throw(Calculator& calc, Args& ss, ostream& out,
+                          const FileAccess& files) {
+        string command = read_command(ss);
+        if (command == "EXPR") {
+            calc.new_expr(parse_expression(ss.rest()));
+        } else if (command == "SAVE") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            calc.save(read_and_validate_new_var(ss));
+        } else if (command == "COMPILE") {
+            auto name = read_and_validate_existing_var(ss, calc);
+            if (!name.has_value()) {
+                throw invalid_argument("Enter variable name");
+            }
+            calc.compile(*name);
+        } else if (command == "DER") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            if (ss.eof()) {
+                print_expr(out, calc.derivative());
+            } else {
+                string name(ss.word());
+                if (!calc.var_exists(name)) {
+                    throw invalid_argument("No variable with name: " + name);
+                }
+                if (ss.eof()) {
+                    print_expr(out, calc.derivative(name));
+                } else {
+                    size_t order = read_order(ss);
+                    print_expr(out, calc.derivative(name, order));
+                    auto sizes = calc.derivative_sizes(name);
+                    for (size_t i = 0; i <= order; i++) {
+                        out << "order " << i << ": " << sizes[i].nodes
+                            << " nodes, " << sizes[i].tree_nodes
+                            << " as tree" << '\n';
+                    }
+                }
+            }
+        } else if (command == "EVAL") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            optional<string> name = read_optional_var(ss, calc);
+            if (is_alpha(ss.peek())) {
+                auto program = name.has_value()
+                    ? calc.program(*name)
+                    : calc.program();
+                vector<double> point = read_assignments(ss, *program);
+                double result;
+                {
+                    Stats::Timer timer(Stats::Stage::EVALUATE);
+                    result = program->evaluate(point.data());
+                }
+                out << result << '\n';
+                return;
+            }
+            vector<double> xs = read_points(ss, files);
+            vector<double> results(xs.size());
+            if (xs.size() == 1) {
+                results[0] = name.has_value()
+                    ? calc.evaluate(*name, xs[0])
+                    : calc.evaluate(xs[0]);
+            } else if (name.has_value()) {
+                calc.evaluate_batch(*name, xs.data(), results.data(),
+                                    xs.size());
+            } else {
+                calc.evaluate_batch(xs.data(), results.data(), xs.size());
+            }
+            for (double result : results) {
+                out << result << '\n';
+            }
+        } else if (command == "RANGE") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            optional<string> name = read_optional_var(ss, calc);
+            double a = read_number(ss);
+            double b = read_number(ss);
+            if (!ss.eof()) {
+                throw invalid_argument("Invalid query");
+            }
+            if (!(a <= b)) {
+                throw invalid_argument("Range must not be empty");
+            }
+            Interval::Bounds bounds = name.has_value()
+                ? calc.range(*name, a, b)
+                : calc.range(a, b);
+            if (bounds.empty()) {
+                out << "undefined everywhere\n";
+                return;
+            }
+            out << bounds.lo << ' ' << bounds.hi << '\n';
+            if (bounds.partial) {
+                out << "may be undefined at some points\n";
+            }
+        } else if (command == "ROOTS") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            optional<string> name = read_optional_var(ss, calc);
+            double a = read_number(ss);
+            double b = read_number(ss);
+            if (!ss.eof()) {
+                throw invalid_argument("Invalid query");
+            }
+            if (!(a <= b)) {
+                throw invalid_argument("Range must not be empty");
+            }
+            vector<Root> found = name.has_value()
+                ? calc.roots(*name, a, b)
+                : calc.roots(a, b);
+            if (found.empty()) {
+                out << "no roots\n";
+            }
+            for (const Root& root : found) {
+                out << root.lo;
+                if (root.hi != root.lo) {
+                    out << ' ' << root.hi;
+                }
+                out << '\n';
+            }
+        } else if (command == "INTEGRATE") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            optional<string> name = read_optional_var(ss, calc);
+            double a = read_number(ss);
+            double b = read_number(ss);
+            double tolerance = ss.eof() ? DEFAULT_TOLERANCE : read_number(ss);
+            if (!ss.eof() || !isfinite(a) || !isfinite(b)) {
+                throw invalid_argument("Invalid query");
+            }
+            if (!(tolerance > 0)) {
+                throw invalid_argument("Tolerance must be positive");
+            }
+            Integral result = name.has_value()
+                ? calc.integrate(*name, a, b, tolerance)
+                : calc.integrate(a, b, tolerance);
+            out << result.value << ' ' << result.error << ' '
+                << result.evaluations << '\n';
+            if (!result.converged) {
+                out << "tolerance not reached\n";
+            }
+        } else if (command == "EVALDER") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            optional<string> name;
+            if (!is_digit(ss.peek()) && ss.peek() != '@') {
+                name = ss.word();
+            }
+            vector<double> xs = read_points(ss, files);
+            if (name.has_value() && !calc.var_exists(*name)) {
+                throw invalid_argument("No variable with name: " + *name);
+            }
+            for (double x : xs) {
+                Node::Dual result = name.has_value()
+                    ? calc.evaluate_dual(*name, x)
+                    : calc.evaluate_dual(x);
+                out << result.value << ' ' << result.derivative << '\n';
+            }
+        } else if (command == "GRAD" || command == "HVP") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            optional<string> name = read_optional_var(ss, calc);
+            auto program = name.has_value()
+                ? calc.program(*name)
+                : calc.program();
+            const vector<size_t>& variables = program->variables();
+            string_view rest = ss.rest();
+            size_t bar = rest.find('|');
+            vector<double> point = read_assignments(Args(rest.substr(0, bar)),
+                                                    *program);
+            vector<double> grad(variables.size());
+            if (command == "GRAD") {
+                if (bar != string_view::npos) {
+                    throw invalid_argument("Invalid query");
+                }
+                double value;
+                {
+                    Stats::Timer timer(Stats::Stage::EVALUATE);
+                    value = program->gradient(point.data(), grad.data());
+                }
+                out << value << '\n';
+                for (size_t slot = 0; slot < variables.size(); slot++) {
+                    out << Node::variable_name(variables[slot]) << ' '
+                        << grad[slot] << '\n';
+                }
+            } else {
+                if (bar == string_view::npos) {
+                    throw invalid_argument("Enter direction after |");
+                }
+                vector<double> direction = read_assignments(
+                    Args(rest.substr(bar + 1)), *program, 0
+                );
+                vector<double> hessian_direction(variables.size());
+                double value;
+                {
+                    Stats::Timer timer(Stats::Stage::EVALUATE);
+                    value = program->hessian_vector(
+                        point.data(), direction.data(),
+                        grad.data(), hessian_direction.data()
+                    );
+                }
+                out << value << '\n';
+                for (size_t slot = 0; slot < variables.size(); slot++) {
+                    out << Node::variable_name(variables[slot]) << ' '
+                        << grad[slot] << ' ' << hessian_direction[slot]
+                        << '\n';
+                }
+            }
+        } else if (command == "DUMP") {
+            Serialize::dump(file_path(read_file_name(ss), files),
+                            calc.session());
+        } else if (command == "LOAD") {
+            calc.restore(Serialize::load(file_path(read_file_name(ss),
+                                                   files)));
+        } else if (command == "STATS") {
+            if (!ss.eof()) {
+                throw invalid_argument("Invalid query");
+            }
+            Stats::print(out);
+        } else if (command == "MEMSTATS") {
+            if (!ss.eof()) {
+                throw invalid_argument("Invalid query");
+            }
+            print_memstats(calc, out);
+        } else if (command == "PRINT") {
+            if (calc.get() == nullptr) {
+                throw invalid_argument("Enter expression");
+            }
+            auto name = read_and_validate_existing_var(ss, calc);
+            if (!name.has_value()) {
+                print_expr(out, calc.get());
+            } else {
+                print_expr(out, calc.get(*name));
+            }
+        } else {
+            throw invalid_argument("Invalid command");
+        }
+    }
+}
+
+void execute(Calculator& calc, string_view line, ostream& out,
+             const FileAccess& files) {
+    Stats::Timer timer(Stats::Stage::COMMAND);
+    begin_command();
+    Args args(line);
+    try {
+        execute_or_throw(calc, args, out, files);
+    } catch (invalid_argument& e) {
+        out << e.what() << '\n';
+    } catch (runtime_error& e) {
+        out << e.what() << '\n';
+    }
+}
+
+bool changes_state(string_view line) {
+    Args args(line);
+    string command = read_command(args);
+    return command == "EXPR" || command == "SAVE" || command == "COMPILE"
+        || command == "DER" || command == "LOAD"
+//        writes a file that a later LOAD may read
+        || command == "DUMP"
+//        reports the command before it on the same thread
+        || command == "MEMSTATS"
+//        sets the last expression
+        || (command == "PRINT" && !args.eof());
+}
+
+ParallelExecutor::ParallelExecutor(Calculator& calc, ostream& out,
+                                   ThreadPool& pool)
+: calc_(calc), out_(out), pool_(pool) {}
+ParallelExecutor::~ParallelExecutor() {
+    finish();
+}
+
+void ParallelExecutor::execute(string_view line) {
+    if (!changes_state(line)) {
+        batch_ += line;
+        batch_ += '\n';
+        if (++batch_size_ == BATCH_SIZE) {
+            dispatch();
+        }
+        return;
+    }
+    dispatch();
+    if (slots_.empty()) {
+        ::execute(calc_, line, out_);
+        return;
+    }
+    ostringstream buf;
+    buf.precision(out_.precision());
+    ::execute(calc_, line, buf);
+    auto slot = make_unique<Slot>();
+    slot->output = buf.str();
+    slot->done = true;
+    slots_.push_back(move(slot));
+}
+void ParallelExecutor::finish() {
+    dispatch();
+    write_ready(0);
+}
+
+void ParallelExecutor::dispatch() {
+    if (batch_size_ == 0) {
+        return;
+    }
+    write_ready(MAX_PENDING);
+    Slot* slot = slots_.emplace_back(make_unique<Slot>()).get();
+    pool_.submit([this, slot, snapshot = calc_, lines = move(batch_),
+                  precision = out_.precision()]() mutable {
+        ostringstream buf;
+        buf.precision(precision);
+        for (string_view rest = lines; !rest.empty(); ) {
+            size_t end = rest.find('\n');
+            ::execute(snapshot, rest.substr(0, end), buf);
+            rest.remove_prefix(end + 1);
+        }
+        slot->output = buf.str();
+//        notified under the lock, since the executor may be destroyed as
+//        soon as the last slot is seen done
+        lock_guard lock(mtx_);
+        slot->done = true;
+        done_.notify_one();
+    });
+    batch_.clear();
+    batch_size_ = 0;
+}
+void ParallelExecutor::write_ready(size_t max_pending) {
+    while (!slots_.empty()) {
+        Slot& front = *slots_.front();
+        {
+            unique_lock lock(mtx_);
+            if (!front.done) {
+                if (slots_.size() <= max_pending) {
+                    return;
+                }
+                done_.wait(lock, [&] {
+                    return front.done;
+                });
+            }
+        }
+        out_ << front.output;
+        slots_.pop_front();
+    }
+}
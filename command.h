@@ -0,0 +1,72 @@
+#pragma once
+
+#include "calculator.h"
+#include "pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+//    files commands may read and write: any path unless restricted, which
+//    remote clients are; then only relative paths without .. under root,
+//    and none if root is empty
+struct FileAccess {
+    bool restricted = false;
+    std::string root;
+};
+
+//    executes one command line against calc and writes its output to out;
+//    errors in the command are written to out as well
+void execute(Calculator& calc, std::string_view line, std::ostream& out,
+             const FileAccess& files = {});
+
+//    true for commands that change the last expression or saved expressions,
+//    for MEMSTATS, which must see the command before it, and for DUMP; they
+//    run on the calling thread in ParallelExecutor
+bool changes_state(std::string_view line);
+
+//    executes command lines on a thread pool with output in input order;
+//    commands that change state run on the calling thread, runs of other
+//    commands run in parallel on snapshots of calc taken when they are
+//    dispatched
+class ParallelExecutor {
+public:
+    ParallelExecutor(Calculator& calc, std::ostream& out, ThreadPool& pool);
+    ParallelExecutor(const ParallelExecutor&) = delete;
+    ParallelExecutor& operator=(const ParallelExecutor&) = delete;
+    ~ParallelExecutor();
+
+    void execute(std::string_view line);
+//    waits for all dispatched commands and writes their output
+    void finish();
+private:
+//    lines per task, so that cheap commands are not dominated by dispatch
+    static constexpr size_t BATCH_SIZE = 256;
+//    tasks whose output is not yet written before dispatch waits
+    static constexpr size_t MAX_PENDING = 1024;
+
+    struct Slot {
+        std::string output;
+        bool done = false;
+    };
+
+    Calculator& calc_;
+    std::ostream& out_;
+    ThreadPool& pool_;
+//    lines not yet dispatched, each followed by a line break
+    std::string batch_;
+    size_t batch_size_ = 0;
+//    dispatched tasks in input order; done is guarded by mtx_
+    std::deque<std::unique_ptr<Slot>> slots_;
+    std::mutex mtx_;
+    std::condition_variable done_;
+
+    void dispatch();
+//    writes finished output, waiting while more than max_pending tasks
+//    are unwritten
+    void write_ready(size_t max_pending);
+};
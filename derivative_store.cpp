@@ -0,0 +1,130 @@
+#include "derivative_store.h"
+#include "serialize.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr const char* EXTENSION = ".der";
+//    eviction frees a quarter of the budget, so that the directory is not
+//    scanned on every write
+    constexpr uint64_t EVICT_TO_NUM = 3;
+    constexpr uint64_t EVICT_TO_DEN = 4;
+
+    atomic<uint64_t> next_tmp{0};
+}
+
+DerivativeStore::DerivativeStore(fs::path dir, uint64_t max_bytes)
+: dir_(move(dir)), max_bytes_(max_bytes) {
+    error_code ec;
+    fs::create_directories(dir_, ec);
+    evict();
+}
+
+bool DerivativeStore::find(const Node::Ptr& expr, size_t order,
+                           Entry& entry) const {
+    fs::path path = path_of(expr, order);
+    Serialize::Session session;
+    try {
+        session = Serialize::load(path.string());
+    } catch (const runtime_error&) {
+        return false;
+    }
+//    nodes are interned, so the stored expression is expr itself unless
+//    the hashes collide
+    if (session.vars.size() != 3 || session.vars[0].second != expr) {
+        return false;
+    }
+    entry = {session.vars[1].second, session.vars[2].second};
+//    marks the file as used for eviction
+    error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+void DerivativeStore::insert(const Node::Ptr& expr, size_t order,
+                             const Entry& entry) {
+    string data = Serialize::encode({nullptr, {
+        {"expr", expr}, {"raw", entry.raw}, {"canonical", entry.canonical}
+    }});
+    if (data.size() > max_bytes_) {
+        return;
+    }
+    fs::path path = path_of(expr, order);
+    string tmp = path.string() + "." + to_string(getpid()) + "."
+        + to_string(next_tmp++);
+    {
+        ofstream out(tmp, ios::binary);
+        out.write(data.data(), data.size());
+        if (!out) {
+            remove(tmp.c_str());
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return;
+    }
+    if (bytes_ += data.size(); bytes_ > max_bytes_) {
+        evict();
+    }
+}
+
+fs::path DerivativeStore::path_of(const Node::Ptr& expr, size_t order) const {
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx-%zu",
+             static_cast<unsigned long long>(expr->hash()), order);
+    return dir_ / (string(name) + EXTENSION);
+}
+
+void DerivativeStore::evict() {
+//    one thread scans at a time; the others go on writing
+    unique_lock lock(evict_mtx_, try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    struct File {
+        fs::file_time_type used;
+        uint64_t size;
+        fs::path path;
+    };
+    vector<File> files;
+    uint64_t total = 0;
+    error_code ec;
+    for (fs::directory_iterator it(dir_, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (it->path().extension() != EXTENSION) {
+            continue;
+        }
+        error_code file_ec;
+        uint64_t size = it->file_size(file_ec);
+        fs::file_time_type used = it->last_write_time(file_ec);
+        if (!file_ec) {
+            files.push_back({used, size, it->path()});
+            total += size;
+        }
+    }
+    if (total > max_bytes_) {
+        sort(files.begin(), files.end(), [](auto& a, auto& b) {
+            return a.used < b.used;
+        });
+        for (const File& file : files) {
+            if (total <= max_bytes_ / EVICT_TO_DEN * EVICT_TO_NUM) {
+                break;
+            }
+            fs::remove(file.path, ec);
+            total -= file.size;
+        }
+    }
+    bytes_ = total;
+}
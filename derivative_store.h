@@ -0,0 +1,46 @@
+#pragma once
+
+#include "expression_tree.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+
+//    derivatives kept on disk across runs: one file per expression and
+//    order, named by the structural hash of the expression and holding the
+//    expression with its derivative in the encoding of DUMP; files are
+//    written under private names and renamed, so any number of processes
+//    may share a directory, and the least recently used ones are removed
+//    once the files take more than the budget
+class DerivativeStore {
+public:
+//    raw is the derivative as computed, the next order is taken from it;
+//    canonical is its canonical form
+    struct Entry {
+        Node::Ptr raw;
+        Node::Ptr canonical;
+    };
+
+//    never throws: a directory that cannot be used makes every lookup miss
+    DerivativeStore(std::filesystem::path dir, uint64_t max_bytes);
+    DerivativeStore(const DerivativeStore&) = delete;
+    DerivativeStore& operator=(const DerivativeStore&) = delete;
+
+//    derivative of order of expr; false if there is none, including files
+//    removed or damaged meanwhile and files of another expression with the
+//    same hash
+    bool find(const Node::Ptr& expr, size_t order, Entry& entry) const;
+    void insert(const Node::Ptr& expr, size_t order, const Entry& entry);
+private:
+    std::filesystem::path dir_;
+    uint64_t max_bytes_;
+//    bytes of all files as of the last scan plus those written since
+    std::atomic<uint64_t> bytes_{0};
+    std::mutex evict_mtx_;
+
+    std::filesystem::path path_of(const Node::Ptr& expr, size_t order) const;
+//    sums the files of the directory, which other processes change too,
+//    and removes the least recently used until they fit
+    void evict();
+};
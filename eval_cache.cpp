@@ -0,0 +1,77 @@
+#include "eval_cache.h"
+
+#include <atomic>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+//    approximate size of an entry with its node in the index
+    constexpr size_t ENTRY_BYTES = 64;
+
+    uint64_t bits_of(double x) {
+        uint64_t ret;
+        memcpy(&ret, &x, sizeof(ret));
+        return ret;
+    }
+}
+
+EvalCache::EvalCache(size_t bytes)
+: shard_capacity_(bytes / ENTRY_BYTES / SHARDS),
+  shards_(make_unique<Shard[]>(SHARDS)) {}
+
+bool EvalCache::find(uint64_t expr, double x, double& value) {
+    Key key{expr, bits_of(x)};
+    Shard& shard = shard_of(key);
+    lock_guard lock(shard.mtx);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    Entry& entry = shard.entries[it->second];
+    entry.referenced = true;
+    value = entry.value;
+    return true;
+}
+void EvalCache::insert(uint64_t expr, double x, double value) {
+    if (shard_capacity_ == 0) {
+        return;
+    }
+    Key key{expr, bits_of(x)};
+    Shard& shard = shard_of(key);
+    lock_guard lock(shard.mtx);
+    auto [it, inserted] = shard.index.try_emplace(key, 0);
+    if (!inserted) {
+        shard.entries[it->second].value = value;
+        return;
+    }
+    if (shard.entries.size() < shard_capacity_) {
+        it->second = shard.entries.size();
+        shard.entries.push_back({key, value, false});
+        return;
+    }
+    while (shard.entries[shard.hand].referenced) {
+        shard.entries[shard.hand].referenced = false;
+        shard.hand = (shard.hand + 1) % shard.entries.size();
+    }
+    Entry& victim = shard.entries[shard.hand];
+    shard.index.erase(victim.key);
+    victim = {key, value, false};
+    it->second = shard.hand;
+    shard.hand = (shard.hand + 1) % shard.entries.size();
+}
+uint64_t EvalCache::new_id() {
+    static atomic<uint64_t> next{1};
+    return next++;
+}
+
+size_t EvalCache::KeyHash::operator()(const Key& key) const {
+    uint64_t z = key.expr * 0x9e3779b97f4a7c15ULL ^ key.x;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+EvalCache::Shard& EvalCache::shard_of(const Key& key) {
+//    the high bits, since the index of the shard uses the low ones
+    return shards_[KeyHash()(key) >> 58];
+}
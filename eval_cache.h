@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+//    results of evaluations keyed by an expression id and the bits of x;
+//    split into shards with a lock each, every shard evicting by the CLOCK
+//    policy once its part of the memory budget is used
+class EvalCache {
+public:
+    explicit EvalCache(size_t bytes);
+    EvalCache(const EvalCache&) = delete;
+    EvalCache& operator=(const EvalCache&) = delete;
+
+    bool find(uint64_t expr, double x, double& value);
+    void insert(uint64_t expr, double x, double value);
+//    ids are never reused, so entries of an expression that was replaced
+//    stop matching and are evicted as the clock passes them
+    static uint64_t new_id();
+private:
+    static constexpr size_t SHARDS = 64;
+
+    struct Key {
+        uint64_t expr;
+        uint64_t x;
+
+        bool operator==(const Key& other) const {
+            return expr == other.expr && x == other.x;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+    struct Entry {
+        Key key;
+        double value;
+//        set by every hit, cleared as the clock hand passes
+        bool referenced;
+    };
+    struct Shard {
+        std::mutex mtx;
+        std::vector<Entry> entries;
+        std::unordered_map<Key, size_t, KeyHash> index;
+        size_t hand = 0;
+    };
+
+    size_t shard_capacity_;
+    std::unique_ptr<Shard[]> shards_;
+
+    Shard& shard_of(const Key& key);
+};
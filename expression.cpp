@@ -1,163 +1,224 @@
 
 #include "expression.h"
 #include "expression_tree.h"
+#include "simplify.h"
+#include "stats.h"
 
+#include <cctype>
 #include <vector>
-#include <istream>
+#include <optional>
 #include <variant>
 #include <stdexcept>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 
-vector<Token> parse_into_tokens(istream& in) {
-    vector<Token> ret;
-    for (Token token; !(in >> ws).eof(); ) {
-        in >> token;
-//        convert binary minus to unary if it follows an opening brace
-        if (token == BinaryOp::Type::DIFF
-            && (ret.empty() || ret.back() == Brace::OPEN)) {
-            ret.push_back(UnaryFunc::NEG);
-        } else {
-            ret.push_back(move(token));
+namespace {
+//    precedence climbing over tokens read on demand, so neither a token list
+//    nor a postfix form is built
+    class Parser {
+    public:
+        explicit Parser(string_view in) : in_(in) {
+            advance();
         }
-    }
-    return ret;
-}
-
-vector<Token> infix_to_postfix(vector<Token> expr) {
-//    implements shunting-yard algorithm
-    vector<Token> ret;
-    vector<Token> stack;
-    for (Token& token : expr) {
-        if (holds_alternative<double>(token)
-            || holds_alternative<Variable>(token)) {
-            ret.push_back(move(token));
-        } else if (holds_alternative<UnaryFunc>(token)) {
-            stack.push_back(move(token));
-        } else if (holds_alternative<BinaryOp::Ptr>(token)) {
-            using namespace BinaryOp;
-            while (!stack.empty() && holds_alternative<Ptr>(stack.back())) {
-                const Base& stack_op = *get<Ptr>(stack.back());
-                const Base& token_op = *get<Ptr>(token);
-                if (stack_op.get_priority() > token_op.get_priority()
-                    || (stack_op.get_priority() == token_op.get_priority()
-                        && token_op.is_left_assoc())) {
-                    ret.push_back(move(stack.back()));
-                    stack.pop_back();
-                } else {
-                    break;
-                }
+        
+        Node::Ptr parse() {
+            Node::Ptr ret = parse_binary(0, true);
+            if (token_.has_value()) {
+                throw invalid_argument("Invalid expression");
             }
-            stack.push_back(move(token));
-        } else if (holds_alternative<Brace>(token)) {
-            switch (get<Brace>(token)) {
-                case Brace::OPEN:
-                    stack.push_back(move(token));
-                    break;
-                case Brace::CLOSE:
-                    while (!stack.empty() && stack.back() != Brace::OPEN) {
-                        ret.push_back(move(stack.back()));
-                        stack.pop_back();
-                    }
-                    if (stack.empty()) {
-                        throw invalid_argument("Invalid expression");
-                    }
-                    stack.pop_back();
-                    if (!stack.empty()
-                        && holds_alternative<UnaryFunc>(stack.back())) {
-                        ret.push_back(move(stack.back()));
-                        stack.pop_back();
-                    }
+            return ret;
+        }
+    private:
+        string_view in_;
+//        empty at the end of input
+        optional<Token> token_;
+        
+        void advance() {
+            while (!in_.empty() && isspace(static_cast<unsigned char>(in_[0]))) {
+                in_.remove_prefix(1);
+            }
+            if (in_.empty()) {
+                token_.reset();
+            } else {
+                token_ = read_token(in_);
+            }
+        }
+        
+        void expect(Brace brace) {
+            if (token_ != brace) {
+                throw invalid_argument("Invalid expression");
+            }
+            advance();
+        }
+        
+//        at_start tells whether the operand opens the input or a brace,
+//        the only places where - is unary
+        Node::Ptr parse_binary(int min_priority, bool at_start) {
+            Node::Ptr left = parse_operand(at_start);
+            while (token_.has_value()
+                   && holds_alternative<BinaryOp::Type>(*token_)) {
+                BinaryOp::Type type = get<BinaryOp::Type>(*token_);
+                const BinaryOp::Base& op = BinaryOp::get(type);
+                if (op.get_priority() < min_priority) {
                     break;
+                }
+                advance();
+                Node::Ptr right = parse_binary(
+                    op.is_left_assoc() ? op.get_priority() + 1
+                                       : op.get_priority(),
+                    false
+                );
+                left = make_binary_op(type, move(left), move(right));
             }
-        } else {
-            throw logic_error("Unreachable code");
+            return left;
         }
-    }
-    while (!stack.empty()) {
-        if (stack.back() == Brace::OPEN) {
-            throw invalid_argument("Invalid expression");
+        
+//        a function or unary minus applies to the braces right after it,
+//        or else to the rest of the enclosing braces: -x+1 = -(x+1)
+        Node::Ptr parse_operand(bool at_start) {
+            optional<UnaryFunc> func;
+            if (at_start && token_ == BinaryOp::Type::DIFF) {
+                func = UnaryFunc::NEG;
+            } else if (token_.has_value()
+                       && holds_alternative<UnaryFunc>(*token_)) {
+                func = get<UnaryFunc>(*token_);
+            } else {
+                return parse_primary();
+            }
+            advance();
+            if (token_ == Brace::OPEN) {
+                return make_unary_func(*func, parse_primary());
+            }
+            return make_unary_func(*func, parse_binary(0, false));
         }
-        ret.push_back(move(stack.back()));
-        stack.pop_back();
-    }
-    return ret;
-}
-
-Node::Ptr build_expression_tree(const vector<Token>& expr) {
-    vector<Node::Ptr> stack;
-    for (const Token& token : expr) {
-        if (holds_alternative<double>(token)) {
-            stack.push_back(make_unique<Node::Constant>(get<double>(token)));
-        } else if (holds_alternative<Variable>(token)) {
-            stack.push_back(make_unique<Node::Variable>());
-        } else if (holds_alternative<UnaryFunc>(token)) {
-            if (stack.empty()) {
+        
+        Node::Ptr parse_primary() {
+            if (!token_.has_value()) {
                 throw invalid_argument("Invalid expression");
             }
-            
+            Token token = *token_;
+            if (holds_alternative<double>(token)) {
+                advance();
+                return Node::make<Node::Constant>(get<double>(token));
+            }
+            if (holds_alternative<Variable>(token)) {
+                advance();
+                return Node::make<Node::Variable>(
+                    Node::variable_index(get<Variable>(token).name)
+                );
+            }
+            if (token == Brace::OPEN) {
+                advance();
+                Node::Ptr ret = parse_binary(0, true);
+                expect(Brace::CLOSE);
+                return ret;
+            }
+            throw invalid_argument("Invalid expression");
+        }
+        
+        static Node::Ptr make_unary_func(UnaryFunc func, Node::Ptr arg) {
             using namespace Node::UnaryFunc;
-            switch (get<UnaryFunc>(token)) {
+            switch (func) {
                 case UnaryFunc::SIN:
-                    stack.back() = make_unique<Sin>(move(stack.back()));
-                    break;
+                    return make_simplified<Sin>(arg);
                 case UnaryFunc::COS:
-                    stack.back() = make_unique<Cos>(move(stack.back()));
-                    break;
+                    return make_simplified<Cos>(arg);
                 case UnaryFunc::TAN:
-                    stack.back() = make_unique<Tan>(move(stack.back()));
-                    break;
+                    return make_simplified<Tan>(arg);
                 case UnaryFunc::COT:
-                    stack.back() = make_unique<Cot>(move(stack.back()));
-                    break;
+                    return make_simplified<Cot>(arg);
                 case UnaryFunc::NEG:
-                    stack.back() = make_unique<Neg>(move(stack.back()));
-                    break;
+                    return make_simplified<Neg>(arg);
                 case UnaryFunc::LN:
-                    stack.back() = make_unique<Ln>(move(stack.back()));
-                    break;
-            }
-        } else if (holds_alternative<BinaryOp::Ptr>(token)) {
-            if (stack.size() < 2) {
-                throw invalid_argument("Invalid expression");
+                    return make_simplified<Ln>(arg);
             }
-            
-            Node::Ptr left = move(stack[stack.size() - 2]);
-            Node::Ptr right = move(stack.back());
-            stack.pop_back();
-            
+            throw logic_error("Unreachable code");
+        }
+        
+        static Node::Ptr make_binary_op(BinaryOp::Type type,
+                                        Node::Ptr left, Node::Ptr right) {
             using BinaryOp::Type;
             using namespace Node::BinaryOp;
-            
-            switch (get<BinaryOp::Ptr>(token)->get_type()) {
+            switch (type) {
                 case Type::SUM:
-                    stack.back() = make_unique<Sum>(move(left), move(right));
-                    break;
+                    return make_simplified<Sum>(left, right);
                 case Type::DIFF:
-                    stack.back() = make_unique<Diff>(move(left), move(right));
-                    break;
+                    return make_simplified<Diff>(left, right);
                 case Type::MULT:
-                    stack.back() = make_unique<Mult>(move(left), move(right));
-                    break;
+                    return make_simplified<Mult>(left, right);
                 case Type::DIV:
-                    stack.back() = make_unique<Div>(move(left), move(right));
-                    break;
+                    return make_simplified<Div>(left, right);
                 case Type::POW:
-                    stack.back() = make_unique<Pow>(move(left), move(right));
-                    break;
+                    return make_simplified<Pow>(left, right);
             }
-        } else {
             throw logic_error("Unreachable code");
         }
+    };
+}
+
+Node::Ptr parse_expression(string_view in) {
+    Node::Ptr ret;
+    {
+        Stats::Timer timer(Stats::Stage::PARSE);
+        ret = Parser(in).parse();
     }
-    if (stack.size() != 1) {
-        throw invalid_argument("Invalid expression");
-    }
-    return stack.back()->make_simplified();
+    Stats::Timer timer(Stats::Stage::SIMPLIFY);
+    return canonicalize(ret);
 }
 
 Node::Ptr derivative(const Node::Base* expr) {
-    return expr->derivative();
+    Node::Ptr ret;
+    {
+        Stats::Timer timer(Stats::Stage::DERIVE);
+        ret = expr->derivative();
+    }
+    Stats::Timer timer(Stats::Stage::SIMPLIFY);
+    return canonicalize(ret);
+}
+
+ExpressionSize expression_size(const Node::Base* expr) {
+    unordered_map<const Node::Base*, uint64_t> tree_nodes;
+    auto count = [&](auto& self, const Node::Base* node) -> uint64_t {
+        if (node == nullptr) {
+            return 0;
+        }
+        if (auto it = tree_nodes.find(node); it != tree_nodes.end()) {
+            return it->second;
+        }
+        Node::Key key = node->key();
+        uint64_t left = self(self, key.left);
+        uint64_t right = self(self, key.right);
+        uint64_t ret = numeric_limits<uint64_t>::max();
+        if (left < ret - 1 - right) {
+            ret = left + right + 1;
+        }
+        tree_nodes.emplace(node, ret);
+        return ret;
+    };
+    uint64_t tree_size = count(count, expr);
+    return {tree_nodes.size(), tree_size};
+}
+
+Footprint footprint(const vector<const Node::Base*>& exprs) {
+    unordered_set<const Node::Base*> seen;
+    vector<const Node::Base*> stack(exprs.begin(), exprs.end());
+    Footprint ret = {0, 0};
+    while (!stack.empty()) {
+        const Node::Base* node = stack.back();
+        stack.pop_back();
+        if (node == nullptr || !seen.insert(node).second) {
+            continue;
+        }
+        Node::Key key = node->key();
+        ret.nodes++;
+        ret.bytes += Node::node_bytes(key.kind);
+        stack.push_back(key.left);
+        stack.push_back(key.right);
+    }
+    return ret;
 }
 
 std::ostream& operator<<(std::ostream& out, const Node::Base* expr) {
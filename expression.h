@@ -3,12 +3,26 @@
 #include "token.h"
 #include "expression_tree.h"
 
+#include <ostream>
+#include <string_view>
 #include <vector>
-#include <istream>
 
-std::vector<Token> parse_into_tokens(std::istream& in);
-std::vector<Token> infix_to_postfix(std::vector<Token> expr);
-Node::Ptr build_expression_tree(const std::vector<Token>& expr);
+Node::Ptr parse_expression(std::string_view in);
 Node::Ptr derivative(const Node::Base* expr);
 
+struct ExpressionSize {
+//    distinct nodes of the DAG
+    size_t nodes;
+//    nodes the expression would have if printed as a tree, saturated
+    uint64_t tree_nodes;
+};
+ExpressionSize expression_size(const Node::Base* expr);
+
+struct Footprint {
+    size_t nodes;
+    uint64_t bytes;
+};
+//    distinct nodes reachable from any of exprs and the bytes they take
+Footprint footprint(const std::vector<const Node::Base*>& exprs);
+
 std::ostream& operator<<(std::ostream& out, const Node::Base* expr);
@@ -1,12 +1,369 @@
 #include "expression_tree.h"
 #include "binary_operation.h"
+#include "bytecode.h"
 
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 #include <iostream>
 using namespace std;
 
 namespace Node {
+    namespace {
+//        open addressing with linear probing, so that registering a node
+//        does not allocate; entries are removed by node destructors
+        class InternTable {
+        public:
+            mutex mtx;
+
+//            live nodes with the same hash but a different key are moved to
+//            mismatched, so that the caller releases them after unlocking
+            Ptr find(uint64_t hash, const Key& key,
+                     vector<Ptr>& mismatched) const {
+                size_t mask = slots_.size() - 1;
+                for (size_t i = hash & mask; slots_[i].state != Slot::EMPTY;
+                     i = (i + 1) & mask) {
+                    const Slot& slot = slots_[i];
+                    if (slot.state != Slot::FULL || slot.hash != hash) {
+                        continue;
+                    }
+                    if (Ptr node = slot.node.lock(); node != nullptr) {
+                        if (node->key() == key) {
+                            return node;
+                        }
+                        mismatched.push_back(move(node));
+                    }
+                }
+                return nullptr;
+            }
+            void insert(uint64_t hash, const Ptr& node) {
+                if ((used_ + 1) * 2 > slots_.size()) {
+                    rehash();
+                }
+                size_t mask = slots_.size() - 1;
+                size_t i = hash & mask;
+                while (slots_[i].state == Slot::FULL) {
+                    i = (i + 1) & mask;
+                }
+                if (slots_[i].state == Slot::EMPTY) {
+                    used_++;
+                }
+                slots_[i] = {hash, node, Slot::FULL};
+                live_++;
+            }
+            void erase_expired(uint64_t hash) {
+                size_t mask = slots_.size() - 1;
+                for (size_t i = hash & mask; slots_[i].state != Slot::EMPTY;
+                     i = (i + 1) & mask) {
+                    Slot& slot = slots_[i];
+                    if (slot.state == Slot::FULL && slot.hash == hash
+                        && slot.node.expired()) {
+                        slot.node.reset();
+                        slot.state = Slot::DELETED;
+                        live_--;
+                    }
+                }
+            }
+        private:
+            struct Slot {
+                enum State : uint8_t {
+                    EMPTY, FULL, DELETED
+                };
+                uint64_t hash = 0;
+                weak_ptr<const Base> node;
+                State state = EMPTY;
+            };
+            vector<Slot> slots_ = vector<Slot>(1024);
+//            number of slots that are not empty, including deleted ones
+            size_t used_ = 0;
+            size_t live_ = 0;
+
+            void rehash() {
+                size_t capacity = slots_.size();
+                while (live_ * 4 > capacity) {
+                    capacity *= 2;
+                }
+                vector<Slot> old = exchange(slots_, vector<Slot>(capacity));
+                used_ = 0;
+                live_ = 0;
+                for (Slot& slot : old) {
+                    if (slot.state == Slot::FULL) {
+                        size_t mask = slots_.size() - 1;
+                        size_t i = slot.hash & mask;
+                        while (slots_[i].state == Slot::FULL) {
+                            i = (i + 1) & mask;
+                        }
+                        slots_[i] = move(slot);
+                        used_++;
+                        live_++;
+                    }
+                }
+            }
+        };
+
+//        intentionally leaked, so that nodes held by other static objects
+//        can still unregister themselves at exit
+        InternTable& intern_table() {
+            static InternTable* table = new InternTable;
+            return *table;
+        }
+
+        uint64_t mix(uint64_t hash, uint64_t val) {
+//            splitmix64 finalizer
+            uint64_t z = hash ^ (val + 0x9e3779b97f4a7c15ULL
+                                 + (hash << 6) + (hash >> 2));
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+//        FNV-1a, which unlike std::hash is the same in every build
+        uint64_t hash_name(const string& name) {
+            uint64_t ret = 0xcbf29ce484222325ULL;
+            for (char c : name) {
+                ret = (ret ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+            }
+            return ret;
+        }
+
+//        variables are hashed by name rather than by index, so that hashes
+//        are the same in every process and can key data on disk
+        uint64_t hash_key(const Key& key) {
+            uint64_t val = key.kind == Kind::VARIABLE
+                ? hash_name(variable_name(key.val))
+                : key.val;
+            uint64_t ret = mix(static_cast<uint64_t>(key.kind), val);
+            if (key.left != nullptr) {
+                ret = mix(ret, key.left->hash());
+            }
+            if (key.right != nullptr) {
+                ret = mix(ret, key.right->hash());
+            }
+            return ret;
+        }
+
+        struct Accounting {
+            array<KindCounters, KIND_COUNT> kinds;
+            atomic<uint64_t> live_bytes{0};
+            atomic<uint64_t> peak_bytes{0};
+        };
+//        leaked like the intern table, for nodes destroyed at exit
+        Accounting& accounting() {
+            static Accounting* ret = new Accounting;
+            return *ret;
+        }
+        KindCounters& counters_of(Kind kind) {
+            return accounting().kinds[static_cast<size_t>(kind)];
+        }
+
+        void count_created(Kind kind) {
+            auto& acc = accounting();
+            KindCounters& counters = counters_of(kind);
+            counters.live.fetch_add(1, memory_order_relaxed);
+            counters.created.fetch_add(1, memory_order_relaxed);
+            uint64_t bytes = acc.live_bytes.fetch_add(
+                node_bytes(kind), memory_order_relaxed
+            ) + node_bytes(kind);
+            uint64_t peak = acc.peak_bytes.load(memory_order_relaxed);
+            while (peak < bytes
+                   && !acc.peak_bytes.compare_exchange_weak(
+                       peak, bytes, memory_order_relaxed)) {}
+        }
+        void count_destroyed(Kind kind) {
+            counters_of(kind).live.fetch_sub(1, memory_order_relaxed);
+            accounting().live_bytes.fetch_sub(node_bytes(kind),
+                                              memory_order_relaxed);
+        }
+        void count_reused(Kind kind) {
+            counters_of(kind).reused.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    const char* kind_name(Kind kind) {
+        switch (kind) {
+            case Kind::CONSTANT:
+                return "constant";
+            case Kind::VARIABLE:
+                return "variable";
+            case Kind::SUM:
+                return "sum";
+            case Kind::DIFF:
+                return "diff";
+            case Kind::MULT:
+                return "mult";
+            case Kind::DIV:
+                return "div";
+            case Kind::POW:
+                return "pow";
+            case Kind::SIN:
+                return "sin";
+            case Kind::COS:
+                return "cos";
+            case Kind::TAN:
+                return "tan";
+            case Kind::COT:
+                return "cot";
+            case Kind::NEG:
+                return "neg";
+            case Kind::LN:
+                return "ln";
+        }
+        throw logic_error("Unreachable code");
+    }
+    const KindCounters& kind_counters(Kind kind) {
+        return counters_of(kind);
+    }
+    size_t node_bytes(Kind kind) {
+        switch (kind) {
+            case Kind::CONSTANT:
+                return sizeof(Constant);
+            case Kind::VARIABLE:
+                return sizeof(Variable);
+            case Kind::SUM:
+                return sizeof(BinaryOp::Sum);
+            case Kind::DIFF:
+                return sizeof(BinaryOp::Diff);
+            case Kind::MULT:
+                return sizeof(BinaryOp::Mult);
+            case Kind::DIV:
+                return sizeof(BinaryOp::Div);
+            case Kind::POW:
+                return sizeof(BinaryOp::Pow);
+            case Kind::SIN:
+                return sizeof(UnaryFunc::Sin);
+            case Kind::COS:
+                return sizeof(UnaryFunc::Cos);
+            case Kind::TAN:
+                return sizeof(UnaryFunc::Tan);
+            case Kind::COT:
+                return sizeof(UnaryFunc::Cot);
+            case Kind::NEG:
+                return sizeof(UnaryFunc::Neg);
+            case Kind::LN:
+                return sizeof(UnaryFunc::Ln);
+        }
+        throw logic_error("Unreachable code");
+    }
+    uint64_t live_bytes() {
+        return accounting().live_bytes.load(memory_order_relaxed);
+    }
+    uint64_t peak_bytes() {
+        return accounting().peak_bytes.load(memory_order_relaxed);
+    }
+    void reset_peak() {
+        auto& acc = accounting();
+        acc.peak_bytes.store(acc.live_bytes.load(memory_order_relaxed),
+                             memory_order_relaxed);
+    }
+
+    bool Key::operator==(const Key& other) const {
+        return kind == other.kind && val == other.val
+            && left == other.left && right == other.right;
+    }
+    Key make_key(Kind kind, double val) {
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        return {kind, bits, nullptr, nullptr};
+    }
+    Key make_key(Kind kind, const Ptr& child) {
+        return {kind, 0, child.get(), nullptr};
+    }
+    Key make_key(Kind kind, const Ptr& left, const Ptr& right) {
+        return {kind, 0, left.get(), right.get()};
+    }
+
+    namespace {
+        struct VariableRegistry {
+            mutex mtx;
+//            keys view names; deque keeps names in place, so nodes and keys
+//            may refer to them
+            unordered_map<string_view, size_t> indices;
+            deque<string> names;
+        };
+        VariableRegistry& variable_registry() {
+            static VariableRegistry* registry = [] {
+                auto ret = new VariableRegistry;
+                ret->names.push_back("x");
+                ret->indices.emplace(ret->names.back(), 0);
+                return ret;
+            }();
+            return *registry;
+        }
+    }
+
+    size_t variable_index(string_view name) {
+        auto& registry = variable_registry();
+        lock_guard lock(registry.mtx);
+        if (auto it = registry.indices.find(name);
+            it != registry.indices.end()) {
+            return it->second;
+        }
+        size_t ret = registry.names.size();
+        registry.names.emplace_back(name);
+        registry.indices.emplace(registry.names.back(), ret);
+        return ret;
+    }
+    const string& variable_name(size_t index) {
+        auto& registry = variable_registry();
+        lock_guard lock(registry.mtx);
+        return registry.names.at(index);
+    }
+
+    Ptr find_interned(const Key& key) {
+        auto& table = intern_table();
+        uint64_t hash = hash_key(key);
+//        released only after the table is unlocked, since dropping the last
+//        reference to a node locks the table again
+        vector<Ptr> mismatched;
+        lock_guard lock(table.mtx);
+        Ptr ret = table.find(hash, key, mismatched);
+        if (ret != nullptr) {
+            count_reused(key.kind);
+        }
+        return ret;
+    }
+    Ptr intern(Ptr node) {
+        auto& table = intern_table();
+        vector<Ptr> mismatched;
+        lock_guard lock(table.mtx);
+        if (Ptr existing = table.find(node->hash(), node->key(), mismatched)) {
+            count_reused(node->kind());
+            return existing;
+        }
+        table.insert(node->hash(), node);
+        return node;
+    }
+
+    Base::Base(const Key& key) : hash_(hash_key(key)), kind_(key.kind) {
+        count_created(kind_);
+    }
+    Base::~Base() {
+        count_destroyed(kind_);
+        auto& table = intern_table();
+        lock_guard lock(table.mtx);
+        table.erase_expired(hash_);
+    }
+    Ptr Base::derivative() const {
+        DerivativeCache cache;
+        return derivative(cache);
+    }
+    Ptr Base::derivative(DerivativeCache& cache) const {
+        if (auto it = cache.find(this); it != cache.end()) {
+            return it->second;
+        }
+        Ptr ret = make_derivative(cache);
+        cache.emplace(this, ret);
+        return ret;
+    }
     bool Base::braces_needed_left(const ::BinaryOp::Base& op) const {
         return false;
     }
@@ -16,81 +373,90 @@ namespace Node {
     optional<double> Base::get_const_value() const {
         return nullopt;
     }
-    bool Base::is_simplified() const {
-        return is_simplified_;
+    Kind Base::kind() const {
+        return kind_;
     }
-    
-    Constant::Constant(double val) : val_(val) {
-        is_simplified_ = true;
+    uint64_t Base::hash() const {
+        return hash_;
+    }
+
+    Constant::Constant(double val) : Base(key_of(val)), val_(val) {}
+    Key Constant::key_of(double val) {
+        return make_key(KIND, val);
     }
     double Constant::evaluate(double x) const {
         return val_;
     }
-    Ptr Constant::derivative() const {
-        return make_unique<Constant>(0);
-    }
-    Ptr Constant::shallow_copy() {
-        return make_unique<Constant>(val_);
-    }
-    Ptr Constant::deep_copy() const {
-        return make_unique<Constant>(val_);
+    Ptr Constant::make_derivative(DerivativeCache& cache) const {
+        return make<Constant>(0);
     }
     void Constant::print(ostream &out) const {
         out << val_;
     }
+    uint32_t Constant::compile(Bytecode::Compiler& compiler) const {
+        return compiler.push_constant(val_);
+    }
     optional<double> Constant::get_const_value() const {
         return val_;
     }
-    Ptr Constant::make_simplified() {
-        return shallow_copy();
+    Key Constant::key() const {
+        return make_key(KIND, val_);
     }
-    
-    Variable::Variable() {
-        is_simplified_ = true;
+
+    Variable::Variable(size_t index)
+    : Base(key_of(index)), index_(index), name_(variable_name(index)) {}
+    Key Variable::key_of(size_t index) {
+        return {KIND, index, nullptr, nullptr};
+    }
+    void Variable::check_is_x() const {
+        if (index_ != 0) {
+            throw invalid_argument("Expression depends on variables other "
+                                   "than x: " + name_);
+        }
     }
     double Variable::evaluate(double x) const {
+        check_is_x();
         return x;
     }
-    Ptr Variable::derivative() const {
-        return make_unique<Constant>(1);
-    }
-    Ptr Variable::shallow_copy() {
-        return make_unique<Variable>();
-    }
-    Ptr Variable::deep_copy() const {
-        return make_unique<Variable>();
+//    partial derivative by x
+    Ptr Variable::make_derivative(DerivativeCache& cache) const {
+        return make<Constant>(index_ == 0 ? 1 : 0);
     }
     void Variable::print(ostream &out) const {
-        out << 'x';
+        out << name_;
     }
-    Ptr Variable::make_simplified() {
-        return shallow_copy();
+    uint32_t Variable::compile(Bytecode::Compiler& compiler) const {
+        return compiler.push_variable(index_);
+    }
+    Key Variable::key() const {
+        return key_of(index_);
     }
     
     namespace BinaryOp {
-        Base::Base(Ptr left, Ptr right, unique_ptr<::BinaryOp::Base> op)
-        : left_(move(left)), right_(move(right)), op_(move(op)) {}
-        
+        Base::Base(Kind kind, Ptr left, Ptr right, const ::BinaryOp::Base& op)
+        : Node::Base(make_key(kind, left, right)),
+          left_(move(left)), right_(move(right)), op_(op) {}
+
         bool Base::braces_needed_left(const ::BinaryOp::Base& op) const {
-            return op_->get_priority() < op.get_priority()
-            || (op_->get_priority() == op.get_priority()
+            return op_.get_priority() < op.get_priority()
+            || (op_.get_priority() == op.get_priority()
                 && !op.is_left_assoc());
         }
         bool Base::braces_needed_right(const ::BinaryOp::Base& op) const {
-            return op_->get_priority() < op.get_priority()
-            || (op_->get_priority() == op.get_priority()
+            return op_.get_priority() < op.get_priority()
+            || (op_.get_priority() == op.get_priority()
                 && op.is_left_assoc());
         }
         void Base::print(ostream& out) const {
-            if (left_->braces_needed_left(*op_)) {
+            if (left_->braces_needed_left(op_)) {
                 out << '(';
                 left_->print(out);
                 out << ')';
             } else {
                 left_->print(out);
             }
-            out << ' ' << op_->repr() << ' ';
-            if (right_->braces_needed_right(*op_)) {
+            out << ' ' << op_.repr() << ' ';
+            if (right_->braces_needed_right(op_)) {
                 out << '(';
                 right_->print(out);
                 out << ')';
@@ -98,354 +464,362 @@ namespace Node {
                 right_->print(out);
             }
         }
-        void Base::simplify_children() {
-            if (!left_->is_simplified()) {
-                left_ = left_->make_simplified();
-            }
-            if (!right_->is_simplified()) {
-                right_ = right_->make_simplified();
-            }
+        uint32_t Base::compile(Bytecode::Compiler& compiler) const {
+            uint32_t left = compiler.compile(left_.get());
+            uint32_t right = compiler.compile(right_.get());
+            return compiler.push_binary_op(op_.get_type(), left, right);
         }
-        unique_ptr<Constant> Base::try_make_constant() {
-            assert(left_->is_simplified() && right_->is_simplified());
-            if (!left_->get_const_value().has_value()
-                || !right_->get_const_value().has_value()) {
-                return nullptr;
-            }
-            return make_unique<Constant>(evaluate(0));
+        Key Base::key() const {
+            return make_key(kind(), left_, right_);
         }
-        
+
         Sum::Sum(Ptr left, Ptr right)
-        : CopyableBase_(move(left), move(right),
-                        make_unique<::BinaryOp::Sum>()) {}
-        double Sum::evaluate(double x) const {
-            return left_->evaluate(x) + right_->evaluate(x);
+        : ApplicableBase_(KIND, move(left), move(right),
+                          ::BinaryOp::get(::BinaryOp::Type::SUM)) {}
+        double Sum::apply(double left, double right) {
+            return left + right;
         }
-        Ptr Sum::derivative() const {
+        Ptr Sum::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<Sum>(
-                left_->derivative(),
-                right_->derivative()
+                left_->derivative(cache),
+                right_->derivative(cache)
             );
         }
-        Ptr Sum::make_simplified() {
-            if (!is_simplified_) {
-                is_simplified_ = true;
-                simplify_children();
-                if (auto ptr = try_make_constant()) {
-                    return ptr;
-                }
-                if (left_->get_const_value().has_value()) {
-                    swap(left_, right_);
-                }
-                if (auto right_val = right_->get_const_value();
-                    right_val.has_value() && abs(*right_val) <= EPS) {
-                    return move(left_);
-                }
+        Ptr Sum::simplify(const Ptr& left, const Ptr& right) {
+            if (auto ptr = try_make_constant(left, right)) {
+                return ptr;
+            }
+            if (left->get_const_value().has_value()) {
+                return ::make_simplified<Sum>(right, left);
             }
-            return shallow_copy();
+            if (auto right_val = right->get_const_value();
+                right_val.has_value() && *right_val == 0) {
+                return left;
+            }
+            return nullptr;
         }
-        
+
         Diff::Diff(Ptr left, Ptr right)
-        : CopyableBase_(move(left), move(right),
-                        make_unique<::BinaryOp::Diff>()) {}
-        double Diff::evaluate(double x) const {
-            return left_->evaluate(x) - right_->evaluate(x);
+        : ApplicableBase_(KIND, move(left), move(right),
+                          ::BinaryOp::get(::BinaryOp::Type::DIFF)) {}
+        double Diff::apply(double left, double right) {
+            return left - right;
         }
-        Ptr Diff::derivative() const {
+        Ptr Diff::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<Diff>(
-                left_->derivative(),
-                right_->derivative()
+                left_->derivative(cache),
+                right_->derivative(cache)
              );
         }
-        Ptr Diff::make_simplified() {
-            if (!is_simplified_) {
-                is_simplified_ = true;
-                simplify_children();
-                if (auto ptr = try_make_constant()) {
-                    return ptr;
-                }
-                if (auto left_val = left_->get_const_value();
-                    left_val.has_value() && abs(*left_val) <= EPS) {
-                    return ::make_simplified<UnaryFunc::Neg>(move(right_));
-                }
-                if (auto right_val = right_->get_const_value();
-                    right_val.has_value() && abs(*right_val) <= EPS) {
-                    return move(left_);
-                }
+        Ptr Diff::simplify(const Ptr& left, const Ptr& right) {
+            if (auto ptr = try_make_constant(left, right)) {
+                return ptr;
+            }
+            if (auto left_val = left->get_const_value();
+                left_val.has_value() && *left_val == 0) {
+                return ::make_simplified<UnaryFunc::Neg>(right);
+            }
+            if (auto right_val = right->get_const_value();
+                right_val.has_value() && *right_val == 0) {
+                return left;
             }
-            return shallow_copy();
+            return nullptr;
         }
-        
+
         Mult::Mult(Ptr left, Ptr right)
-        : CopyableBase_(move(left), move(right),
-                        make_unique<::BinaryOp::Mult>()) {}
-        double Mult::evaluate(double x) const {
-            return left_->evaluate(x) * right_->evaluate(x);
+        : ApplicableBase_(KIND, move(left), move(right),
+                          ::BinaryOp::get(::BinaryOp::Type::MULT)) {}
+        double Mult::apply(double left, double right) {
+            return left * right;
         }
-        Ptr Mult::derivative() const {
+        Ptr Mult::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<Sum>(
                 ::make_simplified<Mult>(
-                    left_->derivative(),
-                    right_->deep_copy()
+                    left_->derivative(cache),
+                    right_
                 ),
                 ::make_simplified<Mult>(
-                    left_->deep_copy(),
-                    right_->derivative()
+                    left_,
+                    right_->derivative(cache)
                 )
             );
         }
-        Ptr Mult::make_simplified() {
-            if (!is_simplified_) {
-                is_simplified_ = true;
-                simplify_children();
-                if (auto ptr = try_make_constant()) {
-                    return ptr;
-                }
-                if (right_->get_const_value().has_value()) {
-                    swap(left_, right_);
+        Ptr Mult::simplify(const Ptr& left, const Ptr& right) {
+            if (auto ptr = try_make_constant(left, right)) {
+                return ptr;
+            }
+            if (right->get_const_value().has_value()) {
+                return ::make_simplified<Mult>(right, left);
+            }
+            if (auto left_val = left->get_const_value();
+                left_val.has_value()) {
+                if (*left_val == 0) {
+                    return make<Constant>(0);
                 }
-                if (auto left_val = left_->get_const_value();
-                    left_val.has_value()) {
-                    if (abs(*left_val) <= EPS) {
-                        return make_unique<Constant>(0);
-                    }
-                    if (abs(*left_val - 1) <= EPS) {
-                        return move(right_);
-                    }
+                if (*left_val == 1) {
+                    return right;
                 }
             }
-            return shallow_copy();
+            return nullptr;
         }
-        
+
         Div::Div(Ptr left, Ptr right)
-        : CopyableBase_(move(left), move(right),
-                        make_unique<::BinaryOp::Div>()) {}
-        double Div::evaluate(double x) const {
-            return left_->evaluate(x) / right_->evaluate(x);
+        : ApplicableBase_(KIND, move(left), move(right),
+                          ::BinaryOp::get(::BinaryOp::Type::DIV)) {}
+        double Div::apply(double left, double right) {
+            return left / right;
         }
-        Ptr Div::derivative() const {
+        Ptr Div::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<Div>(
                 ::make_simplified<Diff>(
                     ::make_simplified<Mult>(
-                        left_->derivative(),
-                        right_->deep_copy()
+                        left_->derivative(cache),
+                        right_
                     ),
                     ::make_simplified<Mult>(
-                        left_->deep_copy(),
-                        right_->derivative()
+                        left_,
+                        right_->derivative(cache)
                     )
                 ),
                 ::make_simplified<Pow>(
-                    right_->deep_copy(),
-                    make_unique<Constant>(2)
+                    right_,
+                    make<Constant>(2)
                 )
             );
         }
-        Ptr Div::make_simplified() {
-            if (!is_simplified_) {
-                is_simplified_ = true;
-                simplify_children();
-                if (auto ptr = try_make_constant()) {
-                    return ptr;
-                }
-                if (auto left_val = left_->get_const_value();
-                    left_val.has_value() && abs(*left_val) <= EPS) {
-                    return make_unique<Constant>(0);
-                }
-                if (auto right_val = right_->get_const_value();
-                    right_val.has_value() && abs(*right_val - 1) <= EPS) {
-                    return move(left_);
-                }
+        Ptr Div::simplify(const Ptr& left, const Ptr& right) {
+            if (auto ptr = try_make_constant(left, right)) {
+                return ptr;
             }
-            return shallow_copy();
+            if (auto left_val = left->get_const_value();
+                left_val.has_value() && *left_val == 0) {
+                return make<Constant>(0);
+            }
+            if (auto right_val = right->get_const_value();
+                right_val.has_value() && *right_val == 1) {
+                return left;
+            }
+            return nullptr;
         }
-        
+
         Pow::Pow(Ptr left, Ptr right)
-        : CopyableBase_(move(left), move(right),
-                        make_unique<::BinaryOp::Pow>()) {}
-        double Pow::evaluate(double x) const {
-            return pow(left_->evaluate(x), right_->evaluate(x));
+        : ApplicableBase_(KIND, move(left), move(right),
+                          ::BinaryOp::get(::BinaryOp::Type::POW)) {}
+        double Pow::apply(double left, double right) {
+            return pow(left, right);
         }
-        Ptr Pow::derivative() const {
+        Ptr Pow::make_derivative(DerivativeCache& cache) const {
             if (auto power = right_->get_const_value(); power.has_value()) {
                 return ::make_simplified<Mult>(
-                    make_unique<Constant>(*power),
-                    ::make_simplified<Pow>(
-                        left_->deep_copy(),
-                        make_unique<Constant>(*power - 1)
-                    )
+                    ::make_simplified<Mult>(
+                        make<Constant>(*power),
+                        ::make_simplified<Pow>(
+                            left_,
+                            make<Constant>(*power - 1)
+                        )
+                    ),
+                    left_->derivative(cache)
                 );
             }
             return ::make_simplified<Mult>(
-                deep_copy(),
+                shared_from_this(),
                 ::make_simplified<Sum>(
                     ::make_simplified<Div>(
                         ::make_simplified<Mult>(
-                            left_->derivative(),
-                            right_->deep_copy()
+                            left_->derivative(cache),
+                            right_
                         ),
-                        left_->deep_copy()
+                        left_
                     ),
                     ::make_simplified<Mult>(
-                        ::make_simplified<UnaryFunc::Ln>(
-                            left_->deep_copy()
-                        ),
-                        right_->derivative()
+                        ::make_simplified<UnaryFunc::Ln>(left_),
+                        right_->derivative(cache)
                     )
                 )
             );
         }
-        Ptr Pow::make_simplified() {
-            if (!is_simplified_) {
-                is_simplified_ = true;
-                simplify_children();
-                if (auto ptr = try_make_constant()) {
-                    return ptr;
+        Ptr Pow::simplify(const Ptr& left, const Ptr& right) {
+            if (auto ptr = try_make_constant(left, right)) {
+                return ptr;
+            }
+            if (auto left_val = left->get_const_value();
+                left_val.has_value()) {
+                if (*left_val == 0) {
+                    return make<Constant>(0);
                 }
-                if (auto left_val = left_->get_const_value();
-                    left_val.has_value()) {
-                    if (abs(*left_val) <= EPS) {
-                        return make_unique<Constant>(0);
-                    }
-                    if (abs(*left_val - 1) <= EPS) {
-                        return make_unique<Constant>(1);
-                    }
+                if (*left_val == 1) {
+                    return make<Constant>(1);
                 }
-                if (auto right_val = right_->get_const_value();
-                    right_val.has_value()) {
-                    if (abs(*right_val) <= EPS) {
-                        return make_unique<Constant>(1);
-                    }
-                    if (abs(*right_val - 1) <= EPS) {
-                        return move(left_);
-                    }
+            }
+            if (auto right_val = right->get_const_value();
+                right_val.has_value()) {
+                if (*right_val == 0) {
+                    return make<Constant>(1);
+                }
+                if (*right_val == 1) {
+                    return left;
                 }
             }
-            return shallow_copy();
+            return nullptr;
         }
     }
-    
+
     namespace UnaryFunc {
-        Base::Base(Ptr child) : child_(move(child)) {}
-        Ptr Base::make_simplified() {
-            if (!is_simplified_) {
-                is_simplified_ = true;
-                if (!child_->is_simplified()) {
-                    child_ = child_->make_simplified();
-                }
-                if (child_->get_const_value().has_value()) {
-                    return make_unique<Constant>(evaluate(0));
-                }
-            }
-            return shallow_copy();
+        Base::Base(Kind kind, Ptr child)
+        : Node::Base(make_key(kind, child)),
+          child_(move(child)) {}
+        Key Base::key() const {
+            return make_key(kind(), child_);
+        }
+
+        double Sin::apply(double val) {
+            return sin(val);
         }
-        
-        double Sin::evaluate(double x) const {
-            return sin(child_->evaluate(x));
+        double Sin::apply_derivative(double val) {
+            return cos(val);
         }
         void Sin::print(std::ostream &out) const {
             out << "sin(";
             child_->print(out);
             out << ")";
         }
-        Ptr Sin::derivative() const {
+        uint32_t Sin::compile(Bytecode::Compiler& compiler) const {
+            return compiler.push_unary_func(::UnaryFunc::SIN,
+                                            compiler.compile(child_.get()));
+        }
+        Ptr Sin::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<BinaryOp::Mult>(
-                ::make_simplified<Cos>(child_->deep_copy()),
-                child_->derivative()
+                ::make_simplified<Cos>(child_),
+                child_->derivative(cache)
            );
         }
-        
-        double Cos::evaluate(double x) const {
-            return cos(child_->evaluate(x));
+
+        double Cos::apply(double val) {
+            return cos(val);
+        }
+        double Cos::apply_derivative(double val) {
+            return -sin(val);
         }
         void Cos::print(std::ostream &out) const {
             out << "cos(";
             child_->print(out);
             out << ")";
         }
-        Ptr Cos::derivative() const {
+        uint32_t Cos::compile(Bytecode::Compiler& compiler) const {
+            return compiler.push_unary_func(::UnaryFunc::COS,
+                                            compiler.compile(child_.get()));
+        }
+        Ptr Cos::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<BinaryOp::Mult>(
-                ::make_simplified<Neg>(::make_simplified<Sin>(child_->deep_copy())),
-                child_->derivative()
+                ::make_simplified<Neg>(::make_simplified<Sin>(child_)),
+                child_->derivative(cache)
             );
         }
-        
-        double Tan::evaluate(double x) const {
-            return tan(child_->evaluate(x));
+
+        double Tan::apply(double val) {
+            return tan(val);
+        }
+        double Tan::apply_derivative(double val) {
+            return 1 / (cos(val) * cos(val));
         }
         void Tan::print(std::ostream &out) const {
             out << "tan(";
             child_->print(out);
             out << ")";
         }
-        Ptr Tan::derivative() const {
+        uint32_t Tan::compile(Bytecode::Compiler& compiler) const {
+            return compiler.push_unary_func(::UnaryFunc::TAN,
+                                            compiler.compile(child_.get()));
+        }
+        Ptr Tan::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<BinaryOp::Mult>(
                 ::make_simplified<BinaryOp::Div>(
-                    make_unique<Constant>(1),
+                    make<Constant>(1),
                     ::make_simplified<BinaryOp::Pow>(
-                        ::make_simplified<Cos>(child_->deep_copy()),
-                        make_unique<Constant>(2)
+                        ::make_simplified<Cos>(child_),
+                        make<Constant>(2)
                     )
                 ),
-                child_->derivative()
+                child_->derivative(cache)
             );
         }
-        
-        double Cot::evaluate(double x) const {
-            return 1 / tan(child_->evaluate(x));
+
+        double Cot::apply(double val) {
+            return 1 / tan(val);
+        }
+        double Cot::apply_derivative(double val) {
+            return -1 / (sin(val) * sin(val));
         }
         void Cot::print(std::ostream &out) const {
             out << "cot(";
             child_->print(out);
             out << ")";
         }
-        Ptr Cot::derivative() const {
+        uint32_t Cot::compile(Bytecode::Compiler& compiler) const {
+            return compiler.push_unary_func(::UnaryFunc::COT,
+                                            compiler.compile(child_.get()));
+        }
+        Ptr Cot::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<BinaryOp::Mult>(
                 ::make_simplified<Neg>(::make_simplified<BinaryOp::Div>(
-                    make_unique<Constant>(1),
+                    make<Constant>(1),
                     ::make_simplified<BinaryOp::Pow>(
-                        ::make_simplified<Sin>(child_->deep_copy()),
-                        make_unique<Constant>(2)
+                        ::make_simplified<Sin>(child_),
+                        make<Constant>(2)
                     )
                 )),
-                child_->derivative()
+                child_->derivative(cache)
             );
         }
-        
-        double Neg::evaluate(double x) const {
-            return -child_->evaluate(x);
+
+        double Neg::apply(double val) {
+            return -val;
+        }
+        double Neg::apply_derivative(double val) {
+            return -1;
         }
         void Neg::print(std::ostream &out) const {
             out << "-(";
             child_->print(out);
             out << ")";
         }
-        Ptr Neg::derivative() const {
-            return ::make_simplified<Neg>(child_->deep_copy());
+        uint32_t Neg::compile(Bytecode::Compiler& compiler) const {
+            return compiler.push_unary_func(::UnaryFunc::NEG,
+                                            compiler.compile(child_.get()));
+        }
+        Ptr Neg::make_derivative(DerivativeCache& cache) const {
+            return ::make_simplified<Neg>(child_->derivative(cache));
         }
         bool Neg::braces_needed_left(const ::BinaryOp::Base& op) const {
             return op.get_type() == ::BinaryOp::Type::POW;
         }
-        
+
         bool Neg::braces_needed_right(const ::BinaryOp::Base& op) const {
             return true;
         }
-        
-        double Ln::evaluate(double x) const {
-            return log(child_->evaluate(x));
+
+        double Ln::apply(double val) {
+            return log(val);
+        }
+        double Ln::apply_derivative(double val) {
+            return 1 / val;
         }
         void Ln::print(std::ostream &out) const {
             out << "ln(";
             child_->print(out);
             out << ")";
         }
-        Ptr Ln::derivative() const {
+        uint32_t Ln::compile(Bytecode::Compiler& compiler) const {
+            return compiler.push_unary_func(::UnaryFunc::LN,
+                                            compiler.compile(child_.get()));
+        }
+        Ptr Ln::make_derivative(DerivativeCache& cache) const {
             return ::make_simplified<BinaryOp::Mult>(
                 ::make_simplified<BinaryOp::Div>(
-                   make_unique<Constant>(1),
-                   child_->deep_copy()
+                   make<Constant>(1),
+                   child_
                 ),
-                child_->derivative()
+                child_->derivative(cache)
             );
         }
     }
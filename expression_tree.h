@@ -1,215 +1,349 @@
 #pragma once
 
 #include "binary_operation.h"
+#include "arena.h"
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Bytecode {
+    class Compiler;
+}
 
 namespace Node {
     class Base;
-    using Ptr = std::unique_ptr<Base>;
-    
-    class Base {
+//    nodes are immutable and hash-consed, so equal subexpressions are shared
+    using Ptr = std::shared_ptr<const Base>;
+//    derivatives of already visited nodes, so that every node of a DAG
+//    is differentiated once
+    using DerivativeCache = std::unordered_map<const Base*, Ptr>;
+
+//    value of an expression together with its derivative by x
+    struct Dual {
+        double value;
+        double derivative;
+    };
+
+    enum class Kind : uint8_t {
+        CONSTANT, VARIABLE, SUM, DIFF, MULT, DIV, POW,
+        SIN, COS, TAN, COT, NEG, LN
+    };
+    constexpr size_t KIND_COUNT = 13;
+    const char* kind_name(Kind kind);
+
+//    allocation accounting by kind: created counts nodes constructed,
+//    reused counts lookups answered by an existing equal node instead
+    struct KindCounters {
+        std::atomic<int64_t> live{0};
+        std::atomic<uint64_t> created{0};
+        std::atomic<uint64_t> reused{0};
+    };
+    const KindCounters& kind_counters(Kind kind);
+//    size of a node of the kind, without its reference counts
+    size_t node_bytes(Kind kind);
+//    bytes of all live nodes, and the most they reached since reset_peak
+    uint64_t live_bytes();
+    uint64_t peak_bytes();
+    void reset_peak();
+
+//    identifies a node up to structure; children are compared by address,
+//    which is enough since they are interned themselves
+    struct Key {
+        Kind kind;
+        uint64_t val;
+        const Base* left;
+        const Base* right;
+
+        bool operator==(const Key& other) const;
+    };
+    Key make_key(Kind kind, double val);
+    Key make_key(Kind kind, const Ptr& child);
+    Key make_key(Kind kind, const Ptr& left, const Ptr& right);
+
+    class Base : public std::enable_shared_from_this<Base> {
     public:
         virtual double evaluate(double x) const = 0;
-        virtual Ptr derivative() const = 0;
-        virtual Ptr shallow_copy() = 0;
-        virtual Ptr deep_copy() const = 0;
+        Ptr derivative() const;
+        Ptr derivative(DerivativeCache& cache) const;
         virtual void print(std::ostream& out) const = 0;
-        
+//        appends instructions computing this node, returns its register
+        virtual uint32_t compile(Bytecode::Compiler& compiler) const = 0;
+
 //        to put braces only where it is needed
         virtual bool braces_needed_left(const ::BinaryOp::Base& op) const;
         virtual bool braces_needed_right(const ::BinaryOp::Base& op) const;
-        
+
         virtual std::optional<double> get_const_value() const;
-//        modifies the object, so the result needs to be assigned to this object
-        virtual Ptr make_simplified() = 0;
-        virtual bool is_simplified() const;
-        
-        virtual ~Base() = default;
+        virtual Key key() const = 0;
+        Kind kind() const;
+//        structural hash, independent of node addresses
+        uint64_t hash() const;
+
+        virtual ~Base();
     protected:
-        bool is_simplified_ = false;
-        static constexpr double EPS = 1e-10;
+        Base(const Key& key);
+        virtual Ptr make_derivative(DerivativeCache& cache) const = 0;
+    private:
+        const uint64_t hash_;
+        const Kind kind_;
     };
-    
+
+//    variables are numbered by name in order of first use; x is always 0
+    size_t variable_index(std::string_view name);
+    const std::string& variable_name(size_t index);
+
+//    returns the interned node equal to key, if it is alive
+    Ptr find_interned(const Key& key);
+//    returns an interned node equal to node, registering node if needed
+    Ptr intern(Ptr node);
+
+    template<typename T, typename... Args>
+    Ptr make(Args&&... args) {
+        if (Ptr ret = find_interned(T::key_of(args...))) {
+            return ret;
+        }
+        return intern(std::allocate_shared<T>(Arena::Allocator<T>(),
+                                              std::forward<Args>(args)...));
+    }
+
     class Constant : public Base {
     public:
+        static constexpr Kind KIND = Kind::CONSTANT;
         Constant(double val);
+        static Key key_of(double val);
         double evaluate(double x) const final;
-        Ptr derivative() const final;
-        Ptr shallow_copy() final;
-        Ptr deep_copy() const final;
         void print(std::ostream& out) const final;
+        uint32_t compile(Bytecode::Compiler& compiler) const final;
         std::optional<double> get_const_value() const final;
-        Ptr make_simplified() final;
+        Key key() const final;
+    protected:
+        Ptr make_derivative(DerivativeCache& cache) const final;
     private:
         const double val_;
     };
-    
+
     class Variable : public Base {
     public:
-        Variable();
+        static constexpr Kind KIND = Kind::VARIABLE;
+        Variable(size_t index);
+        static Key key_of(size_t index);
         double evaluate(double x) const final;
-        Ptr derivative() const final;
-        Ptr shallow_copy() final;
-        Ptr deep_copy() const final;
         void print(std::ostream& out) const final;
-        Ptr make_simplified() final;
+        uint32_t compile(Bytecode::Compiler& compiler) const final;
+        Key key() const final;
+    protected:
+        Ptr make_derivative(DerivativeCache& cache) const final;
+    private:
+        const size_t index_;
+        const std::string& name_;
+//        scalar evaluation is defined only for x
+        void check_is_x() const;
     };
-    
+
     namespace BinaryOp {
         class Base : public Node::Base {
         public:
-            Base(Ptr left, Ptr right, std::unique_ptr<::BinaryOp::Base> op);
+            Base(Kind kind, Ptr left, Ptr right, const ::BinaryOp::Base& op);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
             bool braces_needed_left(const ::BinaryOp::Base& op) const final;
             bool braces_needed_right(const ::BinaryOp::Base& op) const final;
+            Key key() const final;
         protected:
-            Ptr left_, right_;
-            void simplify_children();
-            std::unique_ptr<Constant> try_make_constant();
+            const Ptr left_, right_;
         private:
-            std::unique_ptr<::BinaryOp::Base> op_;
+            const ::BinaryOp::Base& op_;
         };
-        
+
+//        evaluation and constant folding through T::apply
         template<typename T>
-        class CopyableBase_ : public Base {
+        class ApplicableBase_ : public Base {
         public:
             using Base::Base;
-            Ptr shallow_copy() final {
-                auto ret = std::make_unique<T>(std::move(left_),
-                                               std::move(right_));
-                ret->is_simplified_ = is_simplified_;
-                return ret;
+            static Key key_of(const Ptr& left, const Ptr& right) {
+                return make_key(T::KIND, left, right);
+            }
+            double evaluate(double x) const final {
+                return T::apply(left_->evaluate(x), right_->evaluate(x));
             }
-            Ptr deep_copy() const final {
-                auto ret = std::make_unique<T>(left_->deep_copy(),
-                                               right_->deep_copy());
-                ret->is_simplified_ = is_simplified_;
-                return ret;
+        protected:
+            static Ptr try_make_constant(const Ptr& left, const Ptr& right) {
+                auto left_val = left->get_const_value();
+                auto right_val = right->get_const_value();
+                if (!left_val.has_value() || !right_val.has_value()) {
+                    return nullptr;
+                }
+                return make<Constant>(T::apply(*left_val, *right_val));
             }
         };
-        
-        class Sum : public CopyableBase_<Sum> {
+
+        class Sum : public ApplicableBase_<Sum> {
         public:
+            static constexpr Kind KIND = Kind::SUM;
             Sum(Ptr left, Ptr right);
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
-            Ptr make_simplified() final;
+            static double apply(double left, double right);
+//            returns nullptr if the node cannot be simplified
+            static Ptr simplify(const Ptr& left, const Ptr& right);
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Diff : public CopyableBase_<Diff> {
+
+        class Diff : public ApplicableBase_<Diff> {
         public:
+            static constexpr Kind KIND = Kind::DIFF;
             Diff(Ptr left, Ptr right);
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
-            Ptr make_simplified() final;
+            static double apply(double left, double right);
+            static Ptr simplify(const Ptr& left, const Ptr& right);
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Mult : public CopyableBase_<Mult> {
+
+        class Mult : public ApplicableBase_<Mult> {
         public:
+            static constexpr Kind KIND = Kind::MULT;
             Mult(Ptr left, Ptr right);
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
-            Ptr make_simplified() final;
+            static double apply(double left, double right);
+            static Ptr simplify(const Ptr& left, const Ptr& right);
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Div : public CopyableBase_<Div> {
+
+        class Div : public ApplicableBase_<Div> {
         public:
+            static constexpr Kind KIND = Kind::DIV;
             Div(Ptr left, Ptr right);
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
-            Ptr make_simplified() final;
+            static double apply(double left, double right);
+            static Ptr simplify(const Ptr& left, const Ptr& right);
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Pow : public CopyableBase_<Pow> {
+
+        class Pow : public ApplicableBase_<Pow> {
         public:
+            static constexpr Kind KIND = Kind::POW;
             Pow(Ptr left, Ptr right);
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
-            Ptr make_simplified() final;
+            static double apply(double left, double right);
+            static Ptr simplify(const Ptr& left, const Ptr& right);
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
     }
-    
+
     namespace UnaryFunc {
         class Base : public Node::Base {
         public:
-            Base(Ptr child);
-            Ptr make_simplified() final;
+            Base(Kind kind, Ptr child);
+            Key key() const final;
         protected:
-            Ptr child_;
+            const Ptr child_;
         };
-        
+
+//        evaluation and constant folding through T::apply
         template<typename T>
-        class CopyableBase_ : public Base {
+        class ApplicableBase_ : public Base {
         public:
-            using Base::Base;
-            Ptr shallow_copy() final {
-                auto ret = std::make_unique<T>(std::move(child_));
-                ret->is_simplified_ = is_simplified_;
-                return ret;
+            ApplicableBase_(Ptr child) : Base(T::KIND, std::move(child)) {}
+            static Key key_of(const Ptr& child) {
+                return make_key(T::KIND, child);
             }
-            Ptr deep_copy() const final {
-                auto ret = std::make_unique<T>(child_->deep_copy());
-                ret->is_simplified_ = is_simplified_;
-                return ret;
+            double evaluate(double x) const final {
+                return T::apply(child_->evaluate(x));
+            }
+//            returns nullptr if the node cannot be simplified
+            static Ptr simplify(const Ptr& child) {
+                if (auto val = child->get_const_value(); val.has_value()) {
+                    return make<Constant>(T::apply(*val));
+                }
+                return nullptr;
             }
         };
-        
-        class Sin : public CopyableBase_<Sin> {
+
+        class Sin : public ApplicableBase_<Sin> {
         public:
-            using CopyableBase_::CopyableBase_;
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
+            static constexpr Kind KIND = Kind::SIN;
+            using ApplicableBase_::ApplicableBase_;
+            static double apply(double val);
+            static double apply_derivative(double val);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Cos : public CopyableBase_<Cos> {
+
+        class Cos : public ApplicableBase_<Cos> {
         public:
-            using CopyableBase_::CopyableBase_;
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
+            static constexpr Kind KIND = Kind::COS;
+            using ApplicableBase_::ApplicableBase_;
+            static double apply(double val);
+            static double apply_derivative(double val);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Tan : public CopyableBase_<Tan> {
+
+        class Tan : public ApplicableBase_<Tan> {
         public:
-            using CopyableBase_::CopyableBase_;
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
+            static constexpr Kind KIND = Kind::TAN;
+            using ApplicableBase_::ApplicableBase_;
+            static double apply(double val);
+            static double apply_derivative(double val);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Cot : public CopyableBase_<Cot> {
+
+        class Cot : public ApplicableBase_<Cot> {
         public:
-            using CopyableBase_::CopyableBase_;
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
+            static constexpr Kind KIND = Kind::COT;
+            using ApplicableBase_::ApplicableBase_;
+            static double apply(double val);
+            static double apply_derivative(double val);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Neg : public CopyableBase_<Neg> {
+
+        class Neg : public ApplicableBase_<Neg> {
         public:
-            using CopyableBase_::CopyableBase_;
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
+            static constexpr Kind KIND = Kind::NEG;
+            using ApplicableBase_::ApplicableBase_;
+            static double apply(double val);
+            static double apply_derivative(double val);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
             bool braces_needed_left(const ::BinaryOp::Base& op) const final;
             bool braces_needed_right(const ::BinaryOp::Base& op) const final;
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
-        
-        class Ln : public CopyableBase_<Ln> {
+
+        class Ln : public ApplicableBase_<Ln> {
         public:
-            using CopyableBase_::CopyableBase_;
-            double evaluate(double x) const final;
-            Ptr derivative() const final;
+            static constexpr Kind KIND = Kind::LN;
+            using ApplicableBase_::ApplicableBase_;
+            static double apply(double val);
+            static double apply_derivative(double val);
             void print(std::ostream& out) const final;
+            uint32_t compile(Bytecode::Compiler& compiler) const final;
+        protected:
+            Ptr make_derivative(DerivativeCache& cache) const final;
         };
     }
 }
 
+//    builds the node of type T with simplification rules applied
 template<typename T, typename... Args>
 Node::Ptr make_simplified(Args&&... args) {
-    return std::make_unique<T>(std::forward<Args>(args)...)
-        ->make_simplified();
+    if (Node::Ptr ret = T::simplify(args...)) {
+        return ret;
+    }
+    return Node::make<T>(std::forward<Args>(args)...);
 }
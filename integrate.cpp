@@ -0,0 +1,150 @@
+#include "integrate.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+//    Gauss-Kronrod rule of 15 points: abscissae on [-1, 1] from the outside
+//    in, the last one 0, with their Kronrod weights; odd ones are also the
+//    7-point Gauss abscissae, with the Gauss weights below
+    constexpr double KRONROD_NODES[8] = {
+        0.991455371120812639206854697526329,
+        0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926,
+        0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013,
+        0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245,
+        0
+    };
+    constexpr double KRONROD_WEIGHTS[8] = {
+        0.022935322010529224963732008058970,
+        0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518,
+        0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550,
+        0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649,
+        0.209482141084727828012999174891714
+    };
+    constexpr double GAUSS_WEIGHTS[4] = {
+        0.129484966168869693270611432679082,
+        0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975,
+        0.417959183673469387755102040816327
+    };
+    constexpr size_t KRONROD_POINTS = 15;
+//    points evaluated per thread at least, and in all before giving up
+    constexpr size_t INTEGRATE_CHUNK = 1 << 14;
+    constexpr size_t MAX_INTEGRATE_EVALUATIONS = KRONROD_POINTS << 20;
+
+    struct Piece {
+        double a;
+        double b;
+        double value;
+//        difference of the Kronrod and the Gauss estimates
+        double error;
+    };
+
+//    integrals over every span; the points of all of them are evaluated
+//    as one block
+    vector<Piece> kronrod(const Bytecode::Program& expr,
+                          const vector<pair<double, double>>& spans) {
+        vector<double> xs(spans.size() * KRONROD_POINTS);
+        for (size_t i = 0; i < spans.size(); i++) {
+            auto [a, b] = spans[i];
+            double center = a + (b - a) / 2;
+            double half = (b - a) / 2;
+            double* x = &xs[i * KRONROD_POINTS];
+            for (size_t k = 0; k < 7; k++) {
+                x[2 * k] = center - half * KRONROD_NODES[k];
+                x[2 * k + 1] = center + half * KRONROD_NODES[k];
+            }
+            x[14] = center;
+        }
+        vector<double> fs(xs.size());
+        ThreadPool::current().for_chunks(
+            xs.size(), INTEGRATE_CHUNK, [&](size_t first, size_t last) {
+                expr.evaluate_batch(&xs[first], &fs[first], last - first);
+            }
+        );
+
+        vector<Piece> ret;
+        for (size_t i = 0; i < spans.size(); i++) {
+            const double* f = &fs[i * KRONROD_POINTS];
+            double kronrod = f[14] * KRONROD_WEIGHTS[7];
+            double gauss = f[14] * GAUSS_WEIGHTS[3];
+            for (size_t k = 0; k < 7; k++) {
+                double both = f[2 * k] + f[2 * k + 1];
+                kronrod += both * KRONROD_WEIGHTS[k];
+                if (k % 2 == 1) {
+                    gauss += both * GAUSS_WEIGHTS[k / 2];
+                }
+            }
+            auto [a, b] = spans[i];
+            double half = (b - a) / 2;
+            ret.push_back({a, b, kronrod * half,
+                           abs((kronrod - gauss) * half)});
+        }
+        return ret;
+    }
+}
+
+Integral integrate(const Bytecode::Program& expr, double a, double b,
+                   double tolerance) {
+    if (b < a) {
+        Integral ret = integrate(expr, b, a, tolerance);
+        ret.value = -ret.value;
+        return ret;
+    }
+    if (a == b) {
+        return {0, 0, 0, true};
+    }
+    vector<Piece> pieces = kronrod(expr, {{a, b}});
+    Integral ret{0, 0, KRONROD_POINTS, false};
+    while (true) {
+        ret.value = 0;
+        ret.error = 0;
+        for (const Piece& piece : pieces) {
+            ret.value += piece.value;
+            ret.error += piece.error;
+        }
+        double target = tolerance * max(1.0, abs(ret.value));
+        if (ret.error <= target) {
+            ret.converged = true;
+            break;
+        }
+        if (!isfinite(ret.error)) {
+            break;
+        }
+//        every piece with more than its share of the allowed error is
+//        halved, as long as the evaluations last
+        double share = target / pieces.size();
+        vector<Piece> next;
+        vector<pair<double, double>> spans;
+        for (const Piece& piece : pieces) {
+            double mid = piece.a + (piece.b - piece.a) / 2;
+            if (piece.error > share && piece.a < mid && mid < piece.b
+                && ret.evaluations + (spans.size() + 2) * KRONROD_POINTS
+                       <= MAX_INTEGRATE_EVALUATIONS) {
+                spans.emplace_back(piece.a, mid);
+                spans.emplace_back(mid, piece.b);
+            } else {
+                next.push_back(piece);
+            }
+        }
+        if (spans.empty()) {
+            break;
+        }
+        vector<Piece> halves = kronrod(expr, spans);
+        next.insert(next.end(), halves.begin(), halves.end());
+        pieces = move(next);
+        ret.evaluations += spans.size() * KRONROD_POINTS;
+    }
+    return ret;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <cstddef>
+
+struct Integral {
+    double value;
+//    estimate of the absolute error
+    double error;
+    size_t evaluations;
+//    whether the error is within the tolerance
+    bool converged;
+};
+//    integral of expr from a to b by adaptive Gauss-Kronrod quadrature: the
+//    intervals with the largest error estimates are halved until the total
+//    is within tolerance relative to the integral, or absolute below 1
+Integral integrate(const Bytecode::Program& expr, double a, double b,
+                   double tolerance);
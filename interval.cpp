@@ -0,0 +1,257 @@
+#include "interval.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+
+using namespace std;
+
+namespace Interval {
+    namespace {
+        constexpr double PI = 3.14159265358979323846;
+        constexpr double INF = numeric_limits<double>::infinity();
+
+//        a computed value, exact if it has no rounding error
+        struct Rounded {
+            double val;
+            bool exact;
+        };
+//        results of arithmetic and of the math library are within an ulp
+//        of the exact ones, so one step outwards encloses them
+        double lower(const Rounded& r) {
+            return r.exact ? r.val : nextafter(r.val, -INF);
+        }
+        double upper(const Rounded& r) {
+            return r.exact ? r.val : nextafter(r.val, INF);
+        }
+        Rounded inexact(double val) {
+            return {val, false};
+        }
+
+//        exactness by the error terms of two-sum and of fma, which are
+//        exact themselves; an underflow to 0 is not exact
+        Rounded add(double a, double b) {
+            double s = a + b;
+            double bb = s - a;
+            return {s, isfinite(s) && (a - (s - bb)) + (b - bb) == 0};
+        }
+        Rounded subtract(double a, double b) {
+            return add(a, -b);
+        }
+//        0 * inf is 0 for bounds: an operand that is exactly 0 stays 0
+        Rounded multiply(double a, double b) {
+            if (a == 0 || b == 0) {
+                return {0, true};
+            }
+            double p = a * b;
+            return {p, isfinite(p) && p != 0 && fma(a, b, -p) == 0};
+        }
+        Rounded divide(double a, double b) {
+            double q = a / b;
+            return {q, isfinite(q) && (q != 0 || a == 0)
+                       && isfinite(b) && fma(q, b, -a) == 0};
+        }
+//        a ^ n for a natural n by squaring, exact when every step is, and
+//        otherwise from pow, which is closer
+        Rounded natural_power(double a, double n) {
+            Rounded ret{1, true};
+            Rounded base{a, true};
+            for (double k = n; k >= 1 && ret.exact; k = floor(k / 2)) {
+                if (fmod(k, 2) != 0) {
+                    ret = multiply(ret.val, base.val);
+                }
+                if (k >= 2) {
+                    base = multiply(base.val, base.val);
+                    ret.exact = ret.exact && base.exact;
+                }
+            }
+            return ret.exact ? ret : inexact(std::pow(a, n));
+        }
+//        powers of 0 and 1 are exact
+        Rounded power(double a, double b) {
+            return {std::pow(a, b), a == 0 || a == 1};
+        }
+
+        Bounds hull(initializer_list<Rounded> vals, bool partial) {
+            double lo = INF;
+            double hi = -INF;
+            for (const Rounded& r : vals) {
+                if (isnan(r.val)) {
+                    return entire(partial);
+                }
+                lo = min(lo, lower(r));
+                hi = max(hi, upper(r));
+            }
+            return {lo, hi, partial};
+        }
+
+//        whether a point offset + k * period lies in a, counting points
+//        just outside as well, since multiples of pi are not exact
+        bool contains_periodic(const Bounds& a, double offset,
+                               double period) {
+            double margin = 1e-12 * (1 + max(abs(a.lo), abs(a.hi)));
+            double k = floor((a.hi + margin - offset) / period);
+            return offset + k * period >= a.lo - margin;
+        }
+//        bounds of sin or cos over a shorter interval than a period: the
+//        values at the ends, widened to 1 or -1 if a maximum or a minimum
+//        lies in between; f(0) is exact
+        Bounds periodic(const Bounds& a, double (*f)(double),
+                        double max_at, double min_at) {
+            if (a.empty()) {
+                return a;
+            }
+            if (!(a.hi - a.lo < 2 * PI)) {
+                return {-1, 1, a.partial};
+            }
+            Bounds ret = hull({{f(a.lo), a.lo == 0}, {f(a.hi), a.hi == 0}},
+                              a.partial);
+            ret.lo = contains_periodic(a, min_at, 2 * PI)
+                ? -1
+                : max(ret.lo, -1.0);
+            ret.hi = contains_periodic(a, max_at, 2 * PI)
+                ? 1
+                : min(ret.hi, 1.0);
+            return ret;
+        }
+
+//        a ^ n for a natural n: monotone for odd n, through 0 for even n
+        Bounds natural_pow(const Bounds& a, double n) {
+            if (fmod(n, 2) != 0 || a.lo >= 0 || a.hi <= 0) {
+                return hull({natural_power(a.lo, n), natural_power(a.hi, n)},
+                            a.partial);
+            }
+            return {0, upper(natural_power(max(-a.lo, a.hi), n)), a.partial};
+        }
+    }
+
+    Bounds empty() {
+        return {INF, -INF, true};
+    }
+    Bounds entire(bool partial) {
+        return {-INF, INF, partial};
+    }
+    Bounds point(double val) {
+        return isnan(val) ? empty() : Bounds{val, val};
+    }
+    Bounds intersect(const Bounds& a, const Bounds& b) {
+        return {max(a.lo, b.lo), min(a.hi, b.hi), a.partial && b.partial};
+    }
+
+    Bounds sum(const Bounds& a, const Bounds& b) {
+        if (a.empty() || b.empty()) {
+            return empty();
+        }
+        return hull({add(a.lo, b.lo), add(a.hi, b.hi)},
+                    a.partial || b.partial);
+    }
+    Bounds diff(const Bounds& a, const Bounds& b) {
+        if (a.empty() || b.empty()) {
+            return empty();
+        }
+        return hull({subtract(a.lo, b.hi), subtract(a.hi, b.lo)},
+                    a.partial || b.partial);
+    }
+    Bounds mult(const Bounds& a, const Bounds& b) {
+        if (a.empty() || b.empty()) {
+            return empty();
+        }
+        return hull({multiply(a.lo, b.lo), multiply(a.lo, b.hi),
+                     multiply(a.hi, b.lo), multiply(a.hi, b.hi)},
+                    a.partial || b.partial);
+    }
+//    division by 0 is undefined, so a divisor with 0 at one end only
+//    bounds the quotient on one side
+    Bounds div(const Bounds& a, const Bounds& b) {
+        if (a.empty() || b.empty() || (b.lo == 0 && b.hi == 0)) {
+            return empty();
+        }
+        bool partial = a.partial || b.partial || (b.lo <= 0 && b.hi >= 0);
+        if (a.lo == 0 && a.hi == 0) {
+            return {0, 0, partial};
+        }
+        if (b.lo > 0 || b.hi < 0) {
+            return hull({divide(a.lo, b.lo), divide(a.lo, b.hi),
+                         divide(a.hi, b.lo), divide(a.hi, b.hi)}, partial);
+        }
+        Bounds inverse;
+        if (b.lo == 0) {
+            inverse = {lower(divide(1, b.hi)), INF, partial};
+        } else if (b.hi == 0) {
+            inverse = {-INF, upper(divide(1, b.lo)), partial};
+        } else {
+            return entire(partial);
+        }
+        return mult(a, inverse);
+    }
+//    a ^ b is monotone in each operand for a >= 0, so its bounds are at
+//    corners; negative bases are defined only for integer exponents
+    Bounds pow(const Bounds& a, const Bounds& b) {
+        if (a.empty() || b.empty()) {
+            return empty();
+        }
+        if (b.lo == b.hi && b.lo == trunc(b.lo)) {
+            double n = b.lo;
+            if (n == 0) {
+                return {1, 1, a.partial || b.partial};
+            }
+            Bounds ret = natural_pow(a, abs(n));
+            ret.partial = ret.partial || b.partial;
+            return n > 0 ? ret : div({1, 1}, ret);
+        }
+        if (a.lo < 0 && b.lo != b.hi) {
+            return entire(true);
+        }
+        if (a.hi < 0) {
+            return empty();
+        }
+        double lo = max(a.lo, 0.0);
+        return hull({power(lo, b.lo), power(lo, b.hi),
+                     power(a.hi, b.lo), power(a.hi, b.hi)},
+                    a.partial || b.partial || a.lo < 0);
+    }
+
+    Bounds sin(const Bounds& a) {
+        return periodic(a, std::sin, PI / 2, -PI / 2);
+    }
+    Bounds cos(const Bounds& a) {
+        return periodic(a, std::cos, 0, PI);
+    }
+//    increasing between poles at pi / 2 + k * pi
+    Bounds tan(const Bounds& a) {
+        if (a.empty()) {
+            return a;
+        }
+        if (!(a.hi - a.lo < PI) || contains_periodic(a, PI / 2, PI)) {
+            return entire(true);
+        }
+        return hull({{std::tan(a.lo), a.lo == 0},
+                     {std::tan(a.hi), a.hi == 0}}, a.partial);
+    }
+//    decreasing between poles at k * pi; 1 / tan rounds twice, so it is
+//    widened by two steps
+    Bounds cot(const Bounds& a) {
+        if (a.empty()) {
+            return a;
+        }
+        if (!(a.hi - a.lo < PI) || contains_periodic(a, 0, PI)) {
+            return entire(true);
+        }
+        double lo = 1 / std::tan(a.hi);
+        double hi = 1 / std::tan(a.lo);
+        return {nextafter(nextafter(lo, -INF), -INF),
+                nextafter(nextafter(hi, INF), INF), a.partial};
+    }
+    Bounds neg(const Bounds& a) {
+        return {-a.hi, -a.lo, a.partial};
+    }
+    Bounds ln(const Bounds& a) {
+        if (a.empty() || a.hi <= 0) {
+            return empty();
+        }
+        Rounded lo = a.lo <= 0 ? Rounded{-INF, true}
+                               : Rounded{log(a.lo), a.lo == 1};
+        return hull({lo, {log(a.hi), a.hi == 1}}, a.partial || a.lo <= 0);
+    }
+}
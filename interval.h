@@ -0,0 +1,38 @@
+#pragma once
+
+//    interval arithmetic: every operation returns bounds enclosing its
+//    result for all values of the operands within their bounds, rounded
+//    outwards, so the enclosure holds despite rounding errors
+namespace Interval {
+//    [lo, hi]; points where a value is undefined, such as ln of negative
+//    numbers or poles, are left out and marked by partial, and bounds are
+//    empty, with lo > hi, if it is undefined everywhere
+    struct Bounds {
+        double lo;
+        double hi;
+//        may be undefined somewhere; false means defined everywhere
+        bool partial = false;
+
+        bool empty() const {
+            return lo > hi;
+        }
+    };
+    Bounds empty();
+    Bounds entire(bool partial);
+    Bounds point(double val);
+//    bounds within both, which hold the same values
+    Bounds intersect(const Bounds& a, const Bounds& b);
+
+    Bounds sum(const Bounds& a, const Bounds& b);
+    Bounds diff(const Bounds& a, const Bounds& b);
+    Bounds mult(const Bounds& a, const Bounds& b);
+    Bounds div(const Bounds& a, const Bounds& b);
+    Bounds pow(const Bounds& a, const Bounds& b);
+
+    Bounds sin(const Bounds& a);
+    Bounds cos(const Bounds& a);
+    Bounds tan(const Bounds& a);
+    Bounds cot(const Bounds& a);
+    Bounds neg(const Bounds& a);
+    Bounds ln(const Bounds& a);
+}
@@ -0,0 +1,138 @@
+#include "io.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+LineReader::LineReader(int fd) : fd_(fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            mapped_ = static_cast<const char*>(mapped);
+            mapped_size_ = st.st_size;
+            rest_ = string_view(mapped_, mapped_size_);
+        }
+    }
+}
+LineReader::~LineReader() {
+    if (mapped_ != nullptr) {
+        munmap(const_cast<char*>(mapped_), mapped_size_);
+    }
+}
+
+bool LineReader::next(string_view& line) {
+    size_t scanned = 0;
+    size_t pos;
+    while ((pos = rest_.find('\n', scanned)) == string_view::npos) {
+        scanned = rest_.size();
+        if (!fill()) {
+            if (rest_.empty()) {
+                return false;
+            }
+            line = rest_;
+            rest_ = {};
+            return true;
+        }
+    }
+    line = rest_.substr(0, pos);
+    rest_.remove_prefix(pos + 1);
+    return true;
+}
+
+bool LineReader::fill() {
+    if (mapped_ != nullptr || eof_) {
+        return false;
+    }
+    size_t kept = rest_.size();
+    if (kept > 0 && rest_.data() != buffer_.data()) {
+        memmove(buffer_.data(), rest_.data(), kept);
+    }
+    if (buffer_.size() - kept < CHUNK_SIZE) {
+        buffer_.resize(kept + CHUNK_SIZE);
+    }
+    ssize_t n;
+    do {
+        n = read(fd_, buffer_.data() + kept, buffer_.size() - kept);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        throw runtime_error(string("Cannot read input: ") + strerror(errno));
+    }
+    rest_ = string_view(buffer_.data(), kept + n);
+    if (n == 0) {
+        eof_ = true;
+        return false;
+    }
+    return true;
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t size) : fd_(fd), buffer_(size) {
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+OutputBuffer::~OutputBuffer() {
+    sync();
+}
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type c) {
+    if (sync() != 0) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+streamsize OutputBuffer::xsputn(const char* s, streamsize n) {
+    if (n > epptr() - pptr()) {
+        if (sync() != 0) {
+            return 0;
+        }
+//        too large for the buffer, so it is not copied
+        if (n > epptr() - pptr()) {
+            return write_all(s, n) ? n : 0;
+        }
+    }
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+}
+int OutputBuffer::sync() {
+    bool ok = write_all(pbase(), pptr() - pbase());
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return ok ? 0 : -1;
+}
+
+bool OutputBuffer::write_all(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd_, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+filesystem::path cache_dir() {
+    if (const char* dir = getenv("XDG_CACHE_HOME"); dir && *dir) {
+        return filesystem::path(dir) / "derivative-calculator";
+    }
+    if (const char* home = getenv("HOME"); home && *home) {
+        return filesystem::path(home) / ".cache" / "derivative-calculator";
+    }
+    return filesystem::temp_directory_path() / "derivative-calculator";
+}
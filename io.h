@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <streambuf>
+#include <string_view>
+#include <vector>
+
+//    splits the input of a file descriptor into lines; regular files are
+//    mapped into memory, anything else is read in large chunks
+class LineReader {
+public:
+    explicit LineReader(int fd);
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+    ~LineReader();
+
+//    false at the end of input; line excludes the line break and is valid
+//    until the next call
+    bool next(std::string_view& line);
+private:
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    int fd_;
+    const char* mapped_ = nullptr;
+    size_t mapped_size_ = 0;
+//    unread part of the mapping or of buffer_
+    std::string_view rest_;
+    std::vector<char> buffer_;
+    bool eof_ = false;
+
+//    appends the next chunk after rest_; false at the end of input
+    bool fill();
+};
+
+//    stream buffer collecting output into one large block that is written
+//    to a file descriptor when full or on flush
+class OutputBuffer : public std::streambuf {
+public:
+    explicit OutputBuffer(int fd, size_t size = 1 << 20);
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    ~OutputBuffer() override;
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+private:
+    int fd_;
+    std::vector<char> buffer_;
+
+    bool write_all(const char* data, size_t size);
+};
+
+//    directory of files kept across runs: derivative-calculator in
+//    $XDG_CACHE_HOME, or in ~/.cache if it is not set
+std::filesystem::path cache_dir();
@@ -0,0 +1,221 @@
+#include "jit.h"
+#include "io.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+namespace Jit {
+    namespace {
+        atomic<uint64_t> next_tmp{0};
+
+        string quote(const string& str) {
+            string ret = "'";
+            for (char c : str) {
+                if (c == '\'') {
+                    ret += "'\\''";
+                } else {
+                    ret += c;
+                }
+            }
+            return ret + "'";
+        }
+
+        string literal(const string& str) {
+            string ret = "\"";
+            for (char c : str) {
+                if (c == '\\' || c == '"') {
+                    ret += '\\';
+                    ret += c;
+                } else if (c == '\n') {
+                    ret += "\\n\"\n\"";
+                } else {
+                    ret += c;
+                }
+            }
+            return ret + '"';
+        }
+
+//        the library of a hash may hold other code after a collision
+        shared_ptr<const Library> load_if_matches(
+            const string& path, size_t count, const string& source
+        ) {
+            try {
+                auto ret = make_shared<const Library>(path, count);
+                if (ret->source() == source) {
+                    return ret;
+                }
+            } catch (const runtime_error&) {
+            }
+            return nullptr;
+        }
+
+        void print_constant(ostream& out, double val) {
+            if (isnan(val)) {
+                out << "NAN";
+            } else if (isinf(val)) {
+                out << (val < 0 ? "-INFINITY" : "INFINITY");
+            } else {
+//                exact, so native code computes with the same constants
+                out << hexfloat << val << defaultfloat;
+            }
+        }
+    }
+
+    Library::Library(const string& path, size_t count) {
+        handle_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle_ == nullptr) {
+            throw runtime_error("Cannot load " + path + ": " + dlerror());
+        }
+        for (size_t i = 0; i < count; i++) {
+            string name = "f" + to_string(i);
+            void* sym = dlsym(handle_, name.c_str());
+            if (sym == nullptr) {
+                dlclose(handle_);
+                throw runtime_error("No function " + name + " in " + path);
+            }
+            functions_.push_back(reinterpret_cast<Function>(sym));
+        }
+        if (void* sym = dlsym(handle_, "jit_source")) {
+            source_ = static_cast<const char*>(sym);
+        }
+    }
+    Library::~Library() {
+        dlclose(handle_);
+    }
+    Function Library::get(size_t index) const {
+        return functions_.at(index);
+    }
+    const string& Library::source() const {
+        return source_;
+    }
+
+    string generate(const vector<const Bytecode::Program*>& programs) {
+        using Bytecode::OpCode;
+        ostringstream out;
+        out << "#include <math.h>\n";
+        for (size_t i = 0; i < programs.size(); i++) {
+            const auto& code = programs[i]->code();
+            const auto& constants = programs[i]->constants();
+            out << "\ndouble f" << i << "(const double* p) {\n";
+            for (size_t j = 0; j < code.size(); j++) {
+                const Bytecode::Instruction& instr = code[j];
+                string left = "r" + to_string(instr.left);
+                string right = "r" + to_string(instr.right);
+                out << "    double r" << j << " = ";
+                switch (instr.code) {
+                    case OpCode::CONST:
+                        print_constant(out, constants[instr.left]);
+                        break;
+                    case OpCode::VAR:
+                        out << "p[" << instr.left << ']';
+                        break;
+                    case OpCode::SUM:
+                        out << left << " + " << right;
+                        break;
+                    case OpCode::DIFF:
+                        out << left << " - " << right;
+                        break;
+                    case OpCode::MULT:
+                        out << left << " * " << right;
+                        break;
+                    case OpCode::DIV:
+                        out << left << " / " << right;
+                        break;
+                    case OpCode::POW:
+                        out << "pow(" << left << ", " << right << ')';
+                        break;
+                    case OpCode::SIN:
+                        out << "sin(" << left << ')';
+                        break;
+                    case OpCode::COS:
+                        out << "cos(" << left << ')';
+                        break;
+                    case OpCode::TAN:
+                        out << "tan(" << left << ')';
+                        break;
+                    case OpCode::COT:
+                        out << "1 / tan(" << left << ')';
+                        break;
+                    case OpCode::NEG:
+                        out << '-' << left;
+                        break;
+                    case OpCode::LN:
+                        out << "log(" << left << ')';
+                        break;
+                }
+                out << ";\n";
+            }
+            out << "    return r" << code.size() - 1 << ";\n}\n";
+        }
+        return out.str();
+    }
+
+    shared_ptr<const Library> compile(
+        const vector<const Bytecode::Program*>& programs, uint64_t hash
+    ) {
+        string source = generate(programs);
+        fs::path dir = cache_dir();
+        error_code ec;
+        fs::create_directories(dir, ec);
+        if (ec) {
+            throw runtime_error("Cannot create " + dir.string() + ": "
+                                + ec.message());
+        }
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx",
+                 static_cast<unsigned long long>(hash));
+        fs::path library_path = dir / (string(name) + ".so");
+//        the library embeds its source, which is compared, so a hash
+//        collision rebuilds instead of running the wrong code
+        if (fs::exists(library_path)) {
+            if (auto ret = load_if_matches(library_path.string(),
+                                           programs.size(), source)) {
+                return ret;
+            }
+        }
+//        built under a name private to this call and renamed, so concurrent
+//        threads and processes never load a partially written library
+        string tmp = (dir / name).string() + "." + to_string(getpid())
+            + "." + to_string(next_tmp++);
+        {
+            ofstream out(tmp + ".c", ios::binary);
+            out << source << "\nconst char jit_source[] =\n"
+                << literal(source) << ";\n";
+            if (!out) {
+                fs::remove(tmp + ".c", ec);
+                throw runtime_error("Cannot write " + tmp + ".c");
+            }
+        }
+        const char* cc = getenv("CC");
+        string command = string(cc && *cc ? cc : "cc")
+            + " -O2 -ffp-contract=off -shared -fPIC -o "
+            + quote(tmp + ".so") + ' ' + quote(tmp + ".c") + " -lm";
+        int status = system(command.c_str());
+        fs::remove(tmp + ".c", ec);
+        if (status != 0) {
+            fs::remove(tmp + ".so", ec);
+            throw runtime_error("Cannot compile expression: " + command);
+        }
+//        loaded under the private name, so this call runs its own build
+//        whatever other processes publish meanwhile
+        auto ret = make_shared<const Library>(tmp + ".so", programs.size());
+        fs::rename(tmp + ".so", library_path, ec);
+        if (ec) {
+            fs::remove(tmp + ".so", ec);
+        }
+        return ret;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//    native code for bytecode programs: every program is lowered to a C
+//    function, built into a shared object with the system C compiler and
+//    loaded with dlopen
+namespace Jit {
+//    takes a value for every variable slot of its program
+    using Function = double (*)(const double* point);
+
+    class Library {
+    public:
+        Library(const std::string& path, size_t count);
+        Library(const Library&) = delete;
+        Library& operator=(const Library&) = delete;
+        ~Library();
+
+//        function compiled from the program with the given index
+        Function get(size_t index) const;
+//        source the library was generated from, empty if it records none
+        const std::string& source() const;
+    private:
+        void* handle_;
+        std::vector<Function> functions_;
+        std::string source_;
+    };
+
+//    C source of a translation unit defining f<i> for every program
+    std::string generate(const std::vector<const Bytecode::Program*>& programs);
+
+//    libraries are cached on disk under the given structural hash, so
+//    identical programs are not rebuilt after a restart; the compiler is
+//    taken from $CC and the cache directory from $XDG_CACHE_HOME
+    std::shared_ptr<const Library> compile(
+        const std::vector<const Bytecode::Program*>& programs, uint64_t hash
+    );
+}
@@ -1,128 +1,145 @@
-#include "expression_tree.h"
-#include "expression.h"
 #include "calculator.h"
+#include "command.h"
+#include "io.h"
+#include "pool.h"
+#include "server.h"
+#include "stats.h"
 
-#include <iostream>
-#include <unordered_map>
-#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
-#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
 
 using namespace std;
 
-string read_and_validate_new_var(istream& in) {
-    if (in.eof()) {
-        throw invalid_argument("Variable name must not be empty");
-    }
-    string name;
-    in >> name >> ws;
-    if (!in.eof()) {
-        throw invalid_argument("Variable name must not contain spaces");
-    }
-    if (!isalpha(name[0])) {
-        throw invalid_argument("Variable name must start with a letter");
+int main(int argc, char* argv[]) {
+    int fd = STDIN_FILENO;
+//    batch mode flushes output only when the buffer fills and reports
+//    throughput at exit; it is also chosen when input is not a terminal
+    bool batch = !isatty(STDIN_FILENO);
+    optional<size_t> threads;
+    optional<string> serve_address;
+    bool shared = false;
+    size_t eval_cache_bytes = 0;
+    uint64_t derivative_store_bytes = 0;
+    string files_dir;
+    optional<string> stats_file;
+    int stats_interval = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_address = argv[++i];
+        } else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc) {
+            files_dir = argv[++i];
+        } else if (strcmp(argv[i], "--shared") == 0) {
+            shared = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                fd = open(argv[++i], O_RDONLY);
+                if (fd < 0) {
+                    cerr << "Cannot open " << argv[i] << ": "
+                        << strerror(errno) << endl;
+                    return 1;
+                }
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc
+                   && atoi(argv[i + 1]) > 0) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            Stats::enable_stage_timing(true);
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                stats_file = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc
+                   && atoi(argv[i + 1]) > 0) {
+            stats_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eval-cache") == 0 && i + 1 < argc
+                   && atoi(argv[i + 1]) > 0) {
+            eval_cache_bytes = static_cast<size_t>(atoi(argv[++i])) << 20;
+        } else if (strcmp(argv[i], "--derivative-store") == 0
+                   && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            derivative_store_bytes = static_cast<uint64_t>(atoi(argv[++i]))
+                << 20;
+        } else {
+            cerr << "Usage: " << argv[0]
+                << " [--batch [<file>]] [--threads <n>]"
+                << " [--eval-cache <MB>]\n"
+                << "       " << argv[0]
+                << " --serve <port>|<socket path> [--shared] [--threads <n>]"
+                << " [--eval-cache <MB>] [--files <dir>]\n"
+                << "options of both: [--stats [<file>]]"
+                << " [--stats-interval <seconds>]"
+                << " [--derivative-store <MB>]" << endl;
+            return 1;
+        }
     }
-    return name;
-}
-
-optional<string> read_and_validate_existing_var(
-    istream& in, const Calculator& calc
-) {
-    if (in.eof()) {
-        return nullopt;
+//    stage timings and the rest of STATS, written periodically if asked
+    optional<Stats::PeriodicDump> dump;
+    if (stats_file.has_value()) {
+        dump.emplace(*stats_file, chrono::seconds(stats_interval));
     }
-    string name;
-    in >> name >> ws;
-    if (!in.eof()) {
-        throw invalid_argument("Variable name must not contain spaces");
+    if (serve_address.has_value()) {
+        return serve({
+            *serve_address,
+            threads.value_or(max(thread::hardware_concurrency(), 1u)),
+            shared,
+            eval_cache_bytes,
+            derivative_store_bytes,
+            files_dir
+        });
     }
-    if (!calc.var_exists(name)) {
-        throw invalid_argument("No variable with name: " + name);
+//    interactive sessions run commands one by one, so every result is
+//    printed as soon as it is ready
+    if (!threads.has_value()) {
+        threads = batch ? max(thread::hardware_concurrency(), 1u) : 1;
     }
-    return name;
-}
 
-int main() {
-    Calculator calc;
-    
-    string str;
-    string command;
-    
-    cout << setprecision(6);
-    
-    while (getline(cin, str)) {
-        stringstream ss(str);
-        ss >> command >> ws;
-        transform(command.begin(), command.end(), command.begin(), [](char c) {
-            return toupper(static_cast<unsigned char>(c));
-        });
-        try {
-            if (command == "EXPR") {
-                calc.new_expr(build_expression_tree(
-                    infix_to_postfix(parse_into_tokens(ss))
-                ));
-            } else if (command == "SAVE") {
-                if (calc.get() == nullptr) {
-                    throw invalid_argument("Enter expression");
-                }
-                calc.save(read_and_validate_new_var(ss));
-            } else if (command == "DER") {
-                if (calc.get() == nullptr) {
-                    throw invalid_argument("Enter expression");
-                }
-                auto name = read_and_validate_existing_var(ss, calc);
-                if (!name.has_value()) {
-                    cout << calc.derivative().get() << endl;
-                } else {
-                    cout << calc.derivative(*name).get() << endl;
-                }
-            } else if (command == "EVAL") {
-                if (calc.get() == nullptr) {
-                    throw invalid_argument("Enter expression");
-                }
-                if (isdigit(ss.peek())) {
-                    double x;
-                    ss >> x;
-                    if (!ss.eof() && ss.peek() != ' ') {
-                        throw invalid_argument("Variable name must not start with a digit");
-                    }
-                    ss >> ws;
-                    if (!ss.eof()) {
-                        throw invalid_argument("Invalid query");
-                    }
-                    cout << calc.evaluate(x) << endl;
-                } else {
-                    string name;
-                    ss >> name >> ws;
-                    if (!isdigit(ss.peek())) {
-                        throw invalid_argument("Invalid query");
-                    }
-                    double x;
-                    ss >> x >> ws;
-                    if (!ss.eof()) {
-                        throw invalid_argument("Invalid query");
-                    }
-                    if (!calc.var_exists(name)) {
-                        throw invalid_argument("No variable with name: " + name);
-                    }
-                    cout << calc.evaluate(name, x) << endl;
-                }
-            } else if (command == "PRINT") {
-                if (calc.get() == nullptr) {
-                    throw invalid_argument("Enter expression");
-                }
-                auto name = read_and_validate_existing_var(ss, calc);
-                if (!name.has_value()) {
-                    cout << calc.get().get() << endl;
-                } else {
-                    cout << calc.get(*name).get() << endl;
-                }
-            } else {
-                throw invalid_argument("Invalid command");
+    Calculator calc(
+        eval_cache_bytes > 0 ? make_shared<EvalCache>(eval_cache_bytes)
+                             : nullptr,
+        derivative_store_bytes > 0
+            ? make_shared<DerivativeStore>(cache_dir() / "derivatives",
+                                           derivative_store_bytes)
+            : nullptr
+    );
+    OutputBuffer buffer(STDOUT_FILENO);
+    ostream out(&buffer);
+    out << setprecision(6);
+
+    LineReader reader(fd);
+    size_t commands = 0;
+    auto start = chrono::steady_clock::now();
+    if (*threads > 1) {
+        ThreadPool pool(*threads);
+        ParallelExecutor executor(calc, out, pool);
+        for (string_view line; reader.next(line); commands++) {
+            executor.execute(line);
+        }
+        executor.finish();
+    } else {
+        for (string_view line; reader.next(line); commands++) {
+            execute(calc, line, out);
+            if (!batch) {
+                out.flush();
             }
-        } catch (invalid_argument& e) {
-            cout << e.what() << endl;
         }
     }
+    out.flush();
+
+    if (batch) {
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cerr << commands << " commands in " << elapsed.count() << " s, "
+            << commands / elapsed.count() << " commands/s" << endl;
+    }
     return 0;
 }
@@ -0,0 +1,171 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+using namespace std;
+
+namespace {
+//    pool and index of the worker running on this thread, if any
+    thread_local ThreadPool* current_pool = nullptr;
+    thread_local size_t current_index = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers_.push_back(make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        threads_.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (thread& t : threads_) {
+        t.join();
+    }
+}
+
+void ThreadPool::submit(function<void()> task) {
+    size_t index;
+//    counted before it is queued, so pending_ never drops below zero when
+//    another worker takes the task at once
+    {
+        lock_guard lock(mtx_);
+        index = current_pool == this
+            ? current_index
+            : next_++ % workers_.size();
+        pending_++;
+    }
+    {
+        lock_guard lock(workers_[index]->mtx);
+        workers_[index]->tasks.push_back(move(task));
+    }
+    cv_.notify_one();
+}
+size_t ThreadPool::size() const {
+    return workers_.size();
+}
+
+void ThreadPool::for_chunks(size_t n, size_t min_chunk,
+                            const function<void(size_t, size_t)>& body) {
+    size_t chunks = min(workers_.size(),
+                        (n + min_chunk - 1) / max<size_t>(min_chunk, 1));
+    size_t chunk = chunks <= 1 ? n : (n + chunks - 1) / chunks;
+    if (chunk >= n) {
+        body(0, n);
+        return;
+    }
+    struct Join {
+        mutex mtx;
+        condition_variable done;
+        size_t remaining = 0;
+        exception_ptr error;
+    } join;
+    auto run_chunk = [&](size_t first, size_t last) {
+        try {
+            body(first, last);
+        } catch (...) {
+            lock_guard lock(join.mtx);
+            if (!join.error) {
+                join.error = current_exception();
+            }
+        }
+        lock_guard lock(join.mtx);
+        if (--join.remaining == 0) {
+            join.done.notify_all();
+        }
+    };
+    join.remaining = (n + chunk - 1) / chunk;
+    for (size_t first = chunk; first < n; first += chunk) {
+        submit([&run_chunk, first, last = min(first + chunk, n)] {
+            run_chunk(first, last);
+        });
+    }
+    run_chunk(0, chunk);
+//    chunks left in the deques are run here; once none are, the rest are
+//    running on workers
+    size_t index = current_pool == this ? current_index : 0;
+    while (true) {
+        {
+            lock_guard lock(join.mtx);
+            if (join.remaining == 0) {
+                break;
+            }
+        }
+        if (!try_run(index)) {
+            unique_lock lock(join.mtx);
+            join.done.wait(lock, [&] {
+                return join.remaining == 0;
+            });
+            break;
+        }
+    }
+    if (join.error) {
+        rethrow_exception(join.error);
+    }
+}
+
+ThreadPool& ThreadPool::current() {
+    if (current_pool != nullptr) {
+        return *current_pool;
+    }
+    static ThreadPool* shared = new ThreadPool(
+        max(thread::hardware_concurrency(), 1u)
+    );
+    return *shared;
+}
+
+void ThreadPool::run(size_t index) {
+    current_pool = this;
+    current_index = index;
+    while (true) {
+        if (try_run(index)) {
+            continue;
+        }
+        unique_lock lock(mtx_);
+        cv_.wait(lock, [&] {
+            return pending_ > 0 || stop_;
+        });
+        if (pending_ == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::try_run(size_t index) {
+    function<void()> task;
+    {
+        Worker& own = *workers_[index];
+        lock_guard lock(own.mtx);
+        if (!own.tasks.empty()) {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+    for (size_t i = 1; !task && i < workers_.size(); i++) {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        lock_guard lock(victim.mtx);
+        if (!victim.tasks.empty()) {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    {
+        lock_guard lock(mtx_);
+        pending_--;
+    }
+    task();
+    return true;
+}
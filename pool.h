@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//    work-stealing thread pool: every worker runs tasks from its own deque
+//    newest first and, when it is empty, steals the oldest task of another
+//    worker; tasks submitted from a worker go to that worker's deque
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+//    runs the remaining tasks before joining the workers
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+    size_t size() const;
+//    runs body(first, last) over consecutive chunks of [0, n), at least
+//    min_chunk long, at most one per worker, and returns when all are
+//    done; the caller runs tasks of the pool while it waits, so it may be
+//    a task itself. Rethrows the first exception of body
+    void for_chunks(size_t n, size_t min_chunk,
+                    const std::function<void(size_t, size_t)>& body);
+
+//    pool whose worker runs the calling thread, or else one shared by the
+//    process with a worker per core, so that nested parallel work does not
+//    start threads beyond the ones already busy
+    static ThreadPool& current();
+private:
+    struct Worker {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+//    guards pending_ and stop_; workers sleep on cv_ while nothing is pending
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    size_t pending_ = 0;
+    bool stop_ = false;
+    size_t next_ = 0;
+
+    void run(size_t index);
+    bool try_run(size_t index);
+};
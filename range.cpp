@@ -0,0 +1,133 @@
+#include "range.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+using namespace std;
+
+namespace {
+//    splitting stops once the lower bound is within this of a value
+//    reached, relative to the value, or after so many splits
+    constexpr double RANGE_TOLERANCE = 1e-9;
+    constexpr size_t MAX_RANGE_SPLITS = 20000;
+
+//    branch and bound for the lowest value of expr, or of -expr if upper
+    class RangeSearch {
+    public:
+        RangeSearch(const Bytecode::Program& expr,
+                    const Bytecode::Program& der, bool upper)
+        : expr_(expr), der_(der), upper_(upper) {}
+
+        double lower_bound(double a, double b) {
+            reach(a);
+            reach(b);
+            add(a, b);
+            for (size_t splits = 0; !boxes_.empty(); splits++) {
+                const Box& box = boxes_.top();
+                double tolerance = RANGE_TOLERANCE * max(1.0, abs(best_));
+                if (splits == MAX_RANGE_SPLITS
+                    || box.lo >= best_ - tolerance) {
+                    break;
+                }
+                Box split = box;
+                boxes_.pop();
+                double mid = split.a + (split.b - split.a) / 2;
+                if (!(split.a < mid && mid < split.b)) {
+                    finish(split);
+                    continue;
+                }
+                add(split.a, mid);
+                add(mid, split.b);
+            }
+            for (; !boxes_.empty(); boxes_.pop()) {
+                finish(boxes_.top());
+            }
+            return lo_;
+        }
+//        whether expr may be undefined somewhere
+        bool partial() const {
+            return partial_;
+        }
+    private:
+        struct Box {
+            double a;
+            double b;
+            double lo;
+            bool partial;
+
+            bool operator<(const Box& other) const {
+                return lo > other.lo;
+            }
+        };
+
+        const Bytecode::Program& expr_;
+        const Bytecode::Program& der_;
+        bool upper_;
+//        smallest value reached at a point
+        double best_ = numeric_limits<double>::infinity();
+//        bounds of intervals that are not split any more
+        double lo_ = numeric_limits<double>::infinity();
+        bool partial_ = false;
+        priority_queue<Box> boxes_;
+
+//        intervals whose bound exceeds a value reached cannot hold the
+//        lowest one and are not split
+        void add(double a, double b) {
+            Interval::Bounds bounds = evaluate(a, b);
+            if (bounds.empty()) {
+                partial_ = true;
+                return;
+            }
+            Box box{a, b, bounds.lo, bounds.partial};
+            if (box.lo > best_) {
+                finish(box);
+            } else {
+                boxes_.push(box);
+            }
+        }
+        void finish(const Box& box) {
+            lo_ = min(lo_, box.lo);
+            partial_ = partial_ || box.partial;
+        }
+
+//        value at x, which bounds the lowest value from above
+        Interval::Bounds reach(double x) {
+            Interval::Bounds ret = expr_.evaluate_interval({x, x});
+            if (!ret.empty()) {
+                best_ = min(best_, upper_ ? -ret.lo : ret.hi);
+            }
+            return ret;
+        }
+
+//        bounds by the mean value theorem, f(mid) + f'(x) * (x - mid),
+//        shrink with the square of the width where they hold: where the
+//        expression and its derivative are defined everywhere
+        Interval::Bounds evaluate(double a, double b) {
+            Interval::Bounds x{a, b};
+            double mid = a + (b - a) / 2;
+            Interval::Bounds at_mid = reach(mid);
+            Interval::Bounds ret = expr_.evaluate_interval(x);
+            if (!ret.partial && !at_mid.partial) {
+                Interval::Bounds slope = der_.evaluate_interval(x);
+                if (!slope.partial) {
+                    ret = Interval::intersect(ret, Interval::sum(
+                        at_mid,
+                        Interval::mult(slope, Interval::diff(x, {mid, mid}))
+                    ));
+                }
+            }
+            return upper_ ? Interval::neg(ret) : ret;
+        }
+    };
+}
+
+Interval::Bounds range(const Bytecode::Program& expr,
+                       const Bytecode::Program& der, double a, double b) {
+    RangeSearch lower(expr, der, false);
+    RangeSearch upper(expr, der, true);
+    double lo = lower.lower_bound(a, b);
+    double hi = -upper.lower_bound(a, b);
+    return {lo, hi, lower.partial() || upper.partial()};
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "bytecode.h"
+#include "interval.h"
+
+//    bounds of the values of expr for x in [a, b], tight to a relative
+//    tolerance: the intervals with the loosest bounds are split until the
+//    bounds are close to values reached at points; der is the derivative
+//    of expr, which tightens bounds of small intervals
+Interval::Bounds range(const Bytecode::Program& expr,
+                       const Bytecode::Program& der, double a, double b);
@@ -0,0 +1,129 @@
+#include "roots.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+using namespace std;
+
+namespace {
+//    points sampled per unit of x, within the bounds below; wide intervals
+//    are scanned in chunks on several threads
+    constexpr double ROOT_SAMPLES_PER_UNIT = 64;
+    constexpr size_t MIN_ROOT_SAMPLES = 4096;
+    constexpr size_t MAX_ROOT_SAMPLES = 1 << 20;
+    constexpr size_t ROOT_CHUNK = 1 << 16;
+    constexpr size_t ROOT_BRACKET_CHUNK = 256;
+//    bisection alone takes about 60 steps to reach neighbouring doubles
+//    from a bracket of width 1
+    constexpr size_t MAX_ROOT_ITERATIONS = 200;
+
+    bool opposite_signs(double a, double b) {
+        return (a < 0 && b > 0) || (a > 0 && b < 0);
+    }
+
+//    Newton's method kept within the bracket [lo, hi], where expr changes
+//    sign: a step that leaves the bracket or shrinks it by less than half
+//    is replaced by bisection; a pole also changes sign, so a point where
+//    the value is larger than at both ends is no root
+    optional<double> refine(const Bytecode::Program& expr,
+                            const Bytecode::Program& der, double lo,
+                            double hi, double f_lo, double f_hi) {
+        double limit = max(abs(f_lo), abs(f_hi));
+        double x = lo + (hi - lo) / 2;
+        double step = hi - lo;
+        for (size_t i = 0; i < MAX_ROOT_ITERATIONS; i++) {
+            double f = expr.evaluate(x);
+            if (f == 0) {
+                return x;
+            }
+            if (opposite_signs(f, f_lo)) {
+                hi = x;
+                f_hi = f;
+            } else if (opposite_signs(f, f_hi)) {
+                lo = x;
+                f_lo = f;
+            } else {
+                break;
+            }
+            double next = x - f / der.evaluate(x);
+            if (next == x) {
+                break;
+            }
+            double mid = lo + (hi - lo) / 2;
+            if (!(lo < next && next < hi) || abs(next - x) > step / 2) {
+                next = mid;
+            }
+            step = abs(next - x);
+            if (!(lo < next && next < hi)) {
+                break;
+            }
+            x = next;
+        }
+        return abs(expr.evaluate(x)) <= limit ? optional(x) : nullopt;
+    }
+}
+
+vector<Root> roots(const Bytecode::Program& expr,
+                   const Bytecode::Program& der, double a, double b) {
+    double wanted = (b - a) * ROOT_SAMPLES_PER_UNIT;
+    size_t samples = a == b ? 1
+        : !(wanted < MAX_ROOT_SAMPLES) ? MAX_ROOT_SAMPLES
+        : max(MIN_ROOT_SAMPLES, static_cast<size_t>(wanted));
+    vector<double> xs(samples);
+    for (size_t i = 0; i < samples; i++) {
+        xs[i] = i + 1 == samples
+            ? b
+            : a + (b - a) * (static_cast<double>(i) / (samples - 1));
+    }
+    vector<double> fs(samples);
+    ThreadPool& pool = ThreadPool::current();
+    pool.for_chunks(samples, ROOT_CHUNK, [&](size_t first, size_t last) {
+        expr.evaluate_batch(&xs[first], &fs[first], last - first);
+    });
+
+//    runs of samples where expr is 0 are roots as they are; a sign change
+//    between samples i and i + 1 is refined into slot of found
+    vector<Root> found;
+    struct Bracket {
+        size_t slot;
+        size_t i;
+    };
+    vector<Bracket> brackets;
+    for (size_t i = 0; i < samples; i++) {
+        if (fs[i] == 0) {
+            size_t j = i;
+            while (j + 1 < samples && fs[j + 1] == 0) {
+                j++;
+            }
+            found.push_back({xs[i], xs[j]});
+            i = j;
+        } else if (i + 1 < samples && opposite_signs(fs[i], fs[i + 1])) {
+            brackets.push_back({found.size(), i});
+            found.push_back({xs[i], xs[i + 1]});
+        }
+    }
+//    char, since threads write neighbouring elements
+    vector<char> rejected(found.size(), false);
+    pool.for_chunks(brackets.size(), ROOT_BRACKET_CHUNK,
+                    [&](size_t first, size_t last) {
+        for (size_t k = first; k < last; k++) {
+            auto [slot, i] = brackets[k];
+            optional<double> x = refine(expr, der, xs[i], xs[i + 1],
+                                        fs[i], fs[i + 1]);
+            if (x.has_value()) {
+                found[slot] = {*x, *x};
+            } else {
+                rejected[slot] = true;
+            }
+        }
+    });
+    vector<Root> ret;
+    for (size_t i = 0; i < found.size(); i++) {
+        if (!rejected[i]) {
+            ret.push_back(found[i]);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <vector>
+
+//    where expr is 0: a single root if lo == hi, otherwise an interval
+//    where it is 0 at every point sampled
+struct Root {
+    double lo;
+    double hi;
+};
+//    roots of expr in [a, b], sorted: the interval is sampled, at points
+//    closer on narrow intervals, and every sign change between neighbours
+//    is refined by Newton's method with der, the derivative of expr; roots
+//    where the sign does not change and pairs closer than the samples are
+//    missed
+std::vector<Root> roots(const Bytecode::Program& expr,
+                        const Bytecode::Program& der, double a, double b);
@@ -0,0 +1,395 @@
+#include "serialize.h"
+#include "token.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Serialize {
+    namespace {
+        using Node::Ptr;
+        using Node::Kind;
+
+        constexpr char MAGIC[8] = {'D', 'E', 'R', 'C', 'A', 'L', 'C', '\n'};
+//        also tells a file written on a host of other byte order
+        constexpr uint32_t VERSION = 1;
+        constexpr uint32_t LAST = 1;
+
+        atomic<uint64_t> next_tmp{0};
+
+//        followed by the sections in this order: constants as doubles,
+//        nodes, variable names, roots and the text of all names
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t constants;
+            uint32_t nodes;
+            uint32_t symbols;
+            uint32_t roots;
+            uint32_t text_bytes;
+        };
+//        a is the index of the constant, of the variable name, or of the
+//        left or only child; b is the index of the right child
+        struct Record {
+            uint8_t kind;
+            uint8_t padding[3];
+            uint32_t a;
+            uint32_t b;
+        };
+        struct Text {
+            uint32_t offset;
+            uint32_t size;
+        };
+        struct Root {
+            Text name;
+            uint32_t node;
+            uint32_t flags;
+            uint64_t hash;
+        };
+        static_assert(sizeof(Header) == 32 && sizeof(Record) == 12
+                      && sizeof(Text) == 8 && sizeof(Root) == 24);
+
+        template<typename T>
+        void put(string& out, const T& val) {
+            out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+        }
+        template<typename T>
+        void put_all(string& out, const vector<T>& vals) {
+            out.append(reinterpret_cast<const char*>(vals.data()),
+                       vals.size() * sizeof(T));
+        }
+
+        runtime_error invalid() {
+            return runtime_error("Invalid encoding of expressions");
+        }
+
+        class Encoder {
+        public:
+//            iterative, since derivatives of high orders are deep
+            uint32_t add(const Node::Base* root) {
+                vector<const Node::Base*> stack = {root};
+                while (!stack.empty()) {
+                    const Node::Base* node = stack.back();
+                    if (index_.count(node) > 0) {
+                        stack.pop_back();
+                        continue;
+                    }
+                    Node::Key key = node->key();
+                    bool ready = true;
+                    for (const Node::Base* child : {key.right, key.left}) {
+                        if (child != nullptr && index_.count(child) == 0) {
+                            stack.push_back(child);
+                            ready = false;
+                        }
+                    }
+                    if (ready) {
+                        stack.pop_back();
+                        index_.emplace(node, append(key));
+                    }
+                }
+                return index_.at(root);
+            }
+            void add_root(const string& name, const Node::Ptr& tree,
+                          uint32_t flags) {
+                roots_.push_back({text(name), add(tree.get()), flags,
+                                  tree->hash()});
+            }
+
+            string finish() const {
+                Header header;
+                memcpy(header.magic, MAGIC, sizeof(MAGIC));
+                header.version = VERSION;
+                header.constants = constants_.size();
+                header.nodes = records_.size();
+                header.symbols = symbols_.size();
+                header.roots = roots_.size();
+                header.text_bytes = text_.size();
+                string ret;
+                put(ret, header);
+                put_all(ret, constants_);
+                put_all(ret, records_);
+                put_all(ret, symbols_);
+                put_all(ret, roots_);
+                ret += text_;
+                return ret;
+            }
+        private:
+            vector<double> constants_;
+            vector<Record> records_;
+            vector<Text> symbols_;
+            vector<Root> roots_;
+            string text_;
+            unordered_map<const Node::Base*, uint32_t> index_;
+//            by variable index
+            unordered_map<uint64_t, uint32_t> symbol_index_;
+
+            Text text(const string& s) {
+                Text ret{static_cast<uint32_t>(text_.size()),
+                         static_cast<uint32_t>(s.size())};
+                text_ += s;
+                return ret;
+            }
+            uint32_t append(const Node::Key& key) {
+                Record record{static_cast<uint8_t>(key.kind), {}, 0, 0};
+                if (key.kind == Kind::CONSTANT) {
+                    double val;
+                    memcpy(&val, &key.val, sizeof(val));
+                    record.a = constants_.size();
+                    constants_.push_back(val);
+                } else if (key.kind == Kind::VARIABLE) {
+                    auto [it, inserted] = symbol_index_.try_emplace(
+                        key.val, symbols_.size()
+                    );
+                    if (inserted) {
+                        symbols_.push_back(text(Node::variable_name(key.val)));
+                    }
+                    record.a = it->second;
+                } else {
+                    record.a = index_.at(key.left);
+                    if (key.right != nullptr) {
+                        record.b = index_.at(key.right);
+                    }
+                }
+                records_.push_back(record);
+                return records_.size() - 1;
+            }
+        };
+
+//        bounds-checked cursor over the encoding
+        class Reader {
+        public:
+            explicit Reader(string_view data) : rest_(data) {}
+
+            template<typename T>
+            T get() {
+                T ret;
+                memcpy(&ret, take(sizeof(T)).data(), sizeof(T));
+                return ret;
+            }
+            string_view take(uint64_t size) {
+                if (size > rest_.size()) {
+                    throw invalid();
+                }
+                string_view ret = rest_.substr(0, size);
+                rest_.remove_prefix(size);
+                return ret;
+            }
+            bool eof() const {
+                return rest_.empty();
+            }
+        private:
+            string_view rest_;
+        };
+
+        string_view text_of(string_view text, const Text& ref) {
+            if (ref.offset > text.size()
+                || ref.size > text.size() - ref.offset) {
+                throw invalid();
+            }
+            return text.substr(ref.offset, ref.size);
+        }
+
+        Ptr build(Kind kind, const Ptr& left, const Ptr& right) {
+            using namespace Node::BinaryOp;
+            using namespace Node::UnaryFunc;
+            switch (kind) {
+                case Kind::SUM:
+                    return Node::make<Sum>(left, right);
+                case Kind::DIFF:
+                    return Node::make<Diff>(left, right);
+                case Kind::MULT:
+                    return Node::make<Mult>(left, right);
+                case Kind::DIV:
+                    return Node::make<Div>(left, right);
+                case Kind::POW:
+                    return Node::make<Pow>(left, right);
+                case Kind::SIN:
+                    return Node::make<Sin>(left);
+                case Kind::COS:
+                    return Node::make<Cos>(left);
+                case Kind::TAN:
+                    return Node::make<Tan>(left);
+                case Kind::COT:
+                    return Node::make<Cot>(left);
+                case Kind::NEG:
+                    return Node::make<Neg>(left);
+                case Kind::LN:
+                    return Node::make<Ln>(left);
+                case Kind::CONSTANT:
+                case Kind::VARIABLE:
+                    break;
+            }
+            throw logic_error("Unreachable code");
+        }
+        bool is_binary(Kind kind) {
+            return kind >= Kind::SUM && kind <= Kind::POW;
+        }
+
+//        unmapped when destroyed
+        class Mapping {
+        public:
+            explicit Mapping(const string& path) {
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    throw runtime_error("Cannot open file: " + path);
+                }
+                struct stat st;
+                if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+                    && st.st_size > 0) {
+                    void* mapped = mmap(nullptr, st.st_size, PROT_READ,
+                                        MAP_PRIVATE, fd, 0);
+                    if (mapped != MAP_FAILED) {
+                        data_ = string_view(static_cast<const char*>(mapped),
+                                            st.st_size);
+                    }
+                }
+                close(fd);
+                if (data_.data() == nullptr) {
+                    throw runtime_error("Cannot map file: " + path);
+                }
+            }
+            Mapping(const Mapping&) = delete;
+            Mapping& operator=(const Mapping&) = delete;
+            ~Mapping() {
+                munmap(const_cast<char*>(data_.data()), data_.size());
+            }
+
+            string_view data() const {
+                return data_;
+            }
+        private:
+            string_view data_;
+        };
+    }
+
+    string encode(const Session& session) {
+        Encoder encoder;
+        if (session.last != nullptr) {
+            encoder.add_root("", session.last, LAST);
+        }
+        for (const auto& [name, tree] : session.vars) {
+            encoder.add_root(name, tree, 0);
+        }
+        return encoder.finish();
+    }
+
+    Session decode(string_view data) {
+        Reader in(data);
+        auto header = in.get<Header>();
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION) {
+            throw invalid();
+        }
+        string_view constants = in.take(uint64_t(header.constants)
+                                        * sizeof(double));
+        string_view records = in.take(uint64_t(header.nodes) * sizeof(Record));
+        string_view symbols = in.take(uint64_t(header.symbols) * sizeof(Text));
+        string_view roots = in.take(uint64_t(header.roots) * sizeof(Root));
+        string_view text = in.take(header.text_bytes);
+        if (!in.eof()) {
+            throw invalid();
+        }
+
+        vector<Ptr> variables;
+        for (Reader it(symbols); !it.eof(); ) {
+//            names are held to the rules of the parser and of SAVE, so a
+//            file cannot bring in names no command could make
+            string_view name = text_of(text, it.get<Text>());
+            if (!is_variable_name(name)) {
+                throw invalid();
+            }
+            variables.push_back(Node::make<Node::Variable>(
+                Node::variable_index(name)
+            ));
+        }
+        vector<Ptr> nodes;
+        nodes.reserve(header.nodes);
+        for (Reader it(records); !it.eof(); ) {
+            auto record = it.get<Record>();
+            if (record.kind >= Node::KIND_COUNT) {
+                throw invalid();
+            }
+            auto kind = static_cast<Kind>(record.kind);
+            if (kind == Kind::CONSTANT) {
+                if (record.a >= header.constants) {
+                    throw invalid();
+                }
+                double val;
+                memcpy(&val, constants.data() + record.a * sizeof(double),
+                       sizeof(val));
+                nodes.push_back(Node::make<Node::Constant>(val));
+            } else if (kind == Kind::VARIABLE) {
+                if (record.a >= variables.size()) {
+                    throw invalid();
+                }
+                nodes.push_back(variables[record.a]);
+            } else {
+//                children precede their parents, which also rules out cycles
+                if (record.a >= nodes.size()
+                    || (is_binary(kind) && record.b >= nodes.size())) {
+                    throw invalid();
+                }
+                nodes.push_back(build(kind, nodes[record.a],
+                                      is_binary(kind) ? nodes[record.b]
+                                                      : nullptr));
+            }
+        }
+
+        Session ret;
+        for (Reader it(roots); !it.eof(); ) {
+            auto root = it.get<Root>();
+            if (root.node >= nodes.size()
+                || nodes[root.node]->hash() != root.hash) {
+                throw invalid();
+            }
+            const Ptr& tree = nodes[root.node];
+            string_view name = text_of(text, root.name);
+            if (root.flags == LAST && name.empty()) {
+                ret.last = tree;
+            } else if (root.flags == 0 && is_saved_name(name)) {
+                ret.vars.emplace_back(name, tree);
+            } else {
+                throw invalid();
+            }
+        }
+        return ret;
+    }
+
+    void dump(const string& path, const Session& session) {
+        string data = encode(session);
+        string tmp = path + "." + to_string(getpid()) + "."
+            + to_string(next_tmp++);
+        {
+            ofstream out(tmp, ios::binary);
+            out.write(data.data(), data.size());
+            if (!out) {
+                remove(tmp.c_str());
+                throw runtime_error("Cannot write file: " + path);
+            }
+        }
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            remove(tmp.c_str());
+            throw runtime_error("Cannot write file: " + path);
+        }
+    }
+
+    Session load(const string& path) {
+        Mapping mapping(path);
+        try {
+            return decode(mapping.data());
+        } catch (const runtime_error&) {
+            throw runtime_error("Invalid dump file: " + path);
+        }
+    }
+}
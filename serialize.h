@@ -0,0 +1,32 @@
+#pragma once
+
+#include "expression_tree.h"
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//    binary form of expression DAGs: a table of nodes in which children
+//    precede their parents and are referred to by index, so shared
+//    subexpressions are written once, with constants and variable names in
+//    pools of their own; every root carries its structural hash, checked
+//    when it is read back
+namespace Serialize {
+//    the last expression and the saved expressions by name
+    struct Session {
+        Node::Ptr last;
+        std::vector<std::pair<std::string, Node::Ptr>> vars;
+    };
+
+    std::string encode(const Session& session);
+//    builds the nodes of the encoded session without parsing any text;
+//    throws runtime_error if data is not a valid encoding
+    Session decode(std::string_view data);
+
+//    the file is written under a name private to the call and renamed, so
+//    readers never see a partial one
+    void dump(const std::string& path, const Session& session);
+//    maps the file into memory and decodes it in place
+    Session load(const std::string& path);
+}
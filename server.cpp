@@ -0,0 +1,439 @@
+#include "server.h"
+#include "calculator.h"
+#include "command.h"
+#include "io.h"
+#include "pool.h"
+#include "stats.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    using Clock = chrono::steady_clock;
+
+//    longer lines close the connection
+    constexpr size_t MAX_LINE = 1 << 20;
+//    output a connection may have unsent before its commands are paused
+    constexpr size_t MAX_OUTPUT = 4 << 20;
+//    commands a connection may have received but not started before
+//    reading from it is paused; exceeded by at most one read
+    constexpr size_t MAX_QUEUED_LINES = 1 << 14;
+    constexpr size_t MAX_QUEUED_BYTES = 4 << 20;
+    constexpr size_t READ_SIZE = 64 * 1024;
+    constexpr int MAX_EVENTS = 256;
+//    epoll tags of the two descriptors that are not connections
+    constexpr uint64_t LISTEN_ID = 0;
+    constexpr uint64_t WAKEUP_ID = 1;
+
+    struct Line {
+        string text;
+        Clock::time_point received;
+    };
+
+    struct Connection {
+        int fd;
+        shared_ptr<Calculator> calc;
+        string in;
+        string out;
+        size_t out_offset = 0;
+//        received, not yet handed to the pool
+        deque<Line> queued;
+        size_t queued_bytes = 0;
+//        a task runs commands of this connection; only one at a time, so
+//        commands run in the order they arrive
+        bool busy = false;
+        bool read_closed = false;
+//        epoll events the connection is registered for
+        uint32_t events = EPOLLIN;
+
+        size_t unsent() const {
+            return out.size() - out_offset;
+        }
+        bool queue_full() const {
+            return queued.size() >= MAX_QUEUED_LINES
+                || queued_bytes >= MAX_QUEUED_BYTES;
+        }
+        void enqueue(string text, Clock::time_point received) {
+            queued_bytes += text.size();
+            queued.push_back({move(text), received});
+        }
+    };
+
+    struct Completion {
+        uint64_t id;
+        string output;
+    };
+
+    class Server {
+    public:
+        explicit Server(const ServerOptions& options)
+        : options_(options),
+          eval_cache_(options.eval_cache_bytes > 0
+              ? make_shared<EvalCache>(options.eval_cache_bytes)
+              : nullptr),
+          store_(options.derivative_store_bytes > 0
+              ? make_shared<DerivativeStore>(cache_dir() / "derivatives",
+                                             options.derivative_store_bytes)
+              : nullptr),
+          shared_calc_(make_shared<Calculator>(eval_cache_, store_)),
+          files_{true, options.files_dir},
+          pool_(options.threads) {}
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+        ~Server() {
+            for (auto& [id, conn] : connections_) {
+                ::close(conn.fd);
+            }
+            for (int fd : {listen_fd_, epoll_fd_, event_fd_}) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+            }
+        }
+
+        int run() {
+            if (!listen() || !setup_epoll()) {
+                return 1;
+            }
+            epoll_event events[MAX_EVENTS];
+            while (true) {
+                int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return fail("epoll_wait");
+                }
+                for (int i = 0; i < n; i++) {
+                    uint64_t id = events[i].data.u64;
+                    if (id == LISTEN_ID) {
+                        accept_all();
+                    } else if (id == WAKEUP_ID) {
+                        handle_completions();
+                    } else {
+                        handle_event(id, events[i].events);
+                    }
+                }
+            }
+        }
+    private:
+        ServerOptions options_;
+        shared_ptr<EvalCache> eval_cache_;
+        shared_ptr<DerivativeStore> store_;
+        shared_ptr<Calculator> shared_calc_;
+        const FileAccess files_;
+        int listen_fd_ = -1;
+        int epoll_fd_ = -1;
+        int event_fd_ = -1;
+        unordered_map<uint64_t, Connection> connections_;
+        uint64_t next_id_ = WAKEUP_ID + 1;
+//        finished tasks, handed from workers to the event loop
+        mutex mtx_;
+        vector<Completion> completions_;
+//        last, so that it is joined before the members its tasks use
+        ThreadPool pool_;
+
+        static int fail(const string& what) {
+            cerr << what << ": " << strerror(errno) << endl;
+            return 1;
+        }
+
+        bool listen() {
+            const string& address = options_.address;
+            bool tcp = !address.empty()
+                && all_of(address.begin(), address.end(), [](char c) {
+                    return isdigit(static_cast<unsigned char>(c));
+                });
+            listen_fd_ = socket(tcp ? AF_INET : AF_UNIX,
+                                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listen_fd_ < 0) {
+                return !fail("socket");
+            }
+            int bound;
+            if (tcp) {
+                int one = 1;
+                setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR,
+                           &one, sizeof(one));
+                sockaddr_in addr = {};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                addr.sin_port = htons(stoi(address));
+                bound = bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                             sizeof(addr));
+            } else {
+                sockaddr_un addr = {};
+                addr.sun_family = AF_UNIX;
+                if (address.size() >= sizeof(addr.sun_path)) {
+                    cerr << "Socket path too long: " << address << endl;
+                    return false;
+                }
+                strcpy(addr.sun_path, address.c_str());
+                unlink(address.c_str());
+                bound = bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr),
+                             sizeof(addr));
+            }
+            if (bound < 0) {
+                return !fail("Cannot bind " + address);
+            }
+            if (::listen(listen_fd_, SOMAXCONN) < 0) {
+                return !fail("listen");
+            }
+            return true;
+        }
+
+        bool setup_epoll() {
+            epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+            event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (epoll_fd_ < 0 || event_fd_ < 0) {
+                return !fail("epoll");
+            }
+            return watch(listen_fd_, LISTEN_ID, EPOLLIN, EPOLL_CTL_ADD)
+                && watch(event_fd_, WAKEUP_ID, EPOLLIN, EPOLL_CTL_ADD);
+        }
+
+        bool watch(int fd, uint64_t id, uint32_t events, int op) {
+            epoll_event ev = {};
+            ev.events = events;
+            ev.data.u64 = id;
+            if (epoll_ctl(epoll_fd_, op, fd, &ev) < 0) {
+                return !fail("epoll_ctl");
+            }
+            return true;
+        }
+
+        void accept_all() {
+            while (true) {
+                int fd = accept4(listen_fd_, nullptr, nullptr,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK
+                        && errno != EINTR) {
+                        fail("accept");
+                    }
+                    return;
+                }
+                uint64_t id = next_id_++;
+                Connection& conn = connections_[id];
+                conn.fd = fd;
+                conn.calc = options_.shared
+                    ? shared_calc_
+                    : make_shared<Calculator>(eval_cache_, store_);
+                if (!watch(fd, id, EPOLLIN, EPOLL_CTL_ADD)) {
+                    close(id);
+                }
+            }
+        }
+
+        void handle_event(uint64_t id, uint32_t events) {
+            auto it = connections_.find(id);
+            if (it == connections_.end()) {
+                return;
+            }
+            Connection& conn = it->second;
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                close(id);
+                return;
+            }
+            if ((events & EPOLLIN) && !read_input(id, conn)) {
+                return;
+            }
+            if (events & EPOLLOUT) {
+                write_output(id, conn);
+            }
+        }
+
+//        false if the connection was closed
+        bool read_input(uint64_t id, Connection& conn) {
+            char buf[READ_SIZE];
+            while (!conn.queue_full()) {
+                ssize_t n = read(conn.fd, buf, sizeof(buf));
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        break;
+                    }
+                    close(id);
+                    return false;
+                }
+                if (n == 0) {
+                    conn.read_closed = true;
+                    break;
+                }
+                conn.in.append(buf, n);
+                auto now = Clock::now();
+                size_t begin = 0;
+                for (size_t end;
+                     (end = conn.in.find('\n', begin)) != string::npos;
+                     begin = end + 1) {
+                    conn.enqueue(conn.in.substr(begin, end - begin), now);
+                }
+                conn.in.erase(0, begin);
+//                checked on every read, so a line without an end never
+//                grows past it
+                if (conn.in.size() > MAX_LINE) {
+                    close(id);
+                    return false;
+                }
+            }
+            if (conn.read_closed && !conn.in.empty()) {
+                conn.enqueue(move(conn.in), Clock::now());
+                conn.in.clear();
+            }
+            update_events(id, conn);
+            schedule(id, conn);
+            return close_if_done(id, conn);
+        }
+
+//        reads while the client may send and the queue has room, and
+//        waits for room to send while output is pending
+        void update_events(uint64_t id, Connection& conn) {
+            uint32_t events = (conn.read_closed || conn.queue_full()
+                               ? 0u : static_cast<uint32_t>(EPOLLIN))
+                | (conn.unsent() > 0 ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+            if (events != conn.events) {
+                conn.events = events;
+                watch(conn.fd, id, events, EPOLL_CTL_MOD);
+            }
+        }
+
+        void write_output(uint64_t id, Connection& conn) {
+            while (conn.unsent() > 0) {
+                ssize_t n = send(conn.fd, conn.out.data() + conn.out_offset,
+                                 conn.unsent(), MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        break;
+                    }
+                    close(id);
+                    return;
+                }
+                conn.out_offset += n;
+            }
+            bool pending = conn.unsent() > 0;
+            if (!pending) {
+                conn.out.clear();
+                conn.out_offset = 0;
+            }
+            update_events(id, conn);
+            if (!pending) {
+                schedule(id, conn);
+                close_if_done(id, conn);
+            }
+        }
+
+//        hands all queued commands of the connection to the pool as one
+//        task, unless one is already running
+        void schedule(uint64_t id, Connection& conn) {
+            if (conn.busy || conn.queued.empty()
+                || conn.unsent() > MAX_OUTPUT) {
+                return;
+            }
+            conn.busy = true;
+            vector<Line> lines(make_move_iterator(conn.queued.begin()),
+                               make_move_iterator(conn.queued.end()));
+            conn.queued.clear();
+            conn.queued_bytes = 0;
+            update_events(id, conn);
+            pool_.submit([this, id, calc = conn.calc, lines = move(lines)] {
+                ostringstream out;
+                out.precision(6);
+                for (const Line& line : lines) {
+                    execute(*calc, line.text, out, files_);
+                    Stats::request_latency().record(
+                        chrono::duration_cast<chrono::nanoseconds>(
+                            Clock::now() - line.received
+                        ).count()
+                    );
+                }
+                {
+                    lock_guard lock(mtx_);
+                    completions_.push_back({id, out.str()});
+                }
+                uint64_t one = 1;
+                static_cast<void>(write(event_fd_, &one, sizeof(one)));
+            });
+        }
+
+        void handle_completions() {
+            uint64_t count;
+            static_cast<void>(read(event_fd_, &count, sizeof(count)));
+            vector<Completion> completions;
+            {
+                lock_guard lock(mtx_);
+                completions.swap(completions_);
+            }
+            for (Completion& completion : completions) {
+                auto it = connections_.find(completion.id);
+                if (it == connections_.end()) {
+                    continue;
+                }
+                Connection& conn = it->second;
+                conn.busy = false;
+                conn.out += completion.output;
+                write_output(completion.id, conn);
+            }
+        }
+
+//        closes a connection whose client stopped sending once all its
+//        commands are answered; false if it was closed
+        bool close_if_done(uint64_t id, Connection& conn) {
+            if (conn.read_closed && !conn.busy && conn.queued.empty()
+                && conn.unsent() == 0) {
+                close(id);
+                return false;
+            }
+            return true;
+        }
+
+        void close(uint64_t id) {
+            auto it = connections_.find(id);
+            if (it == connections_.end()) {
+                return;
+            }
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+            ::close(it->second.fd);
+            connections_.erase(it);
+        }
+    };
+}
+
+int serve(const ServerOptions& options) {
+    signal(SIGPIPE, SIG_IGN);
+//    every connection takes a descriptor
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    Server server(options);
+    return server.run();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//    serves the command language to many clients at once: an epoll loop
+//    handles connections and a thread pool runs their commands, which
+//    answer in the order they arrive on each connection
+struct ServerOptions {
+//    localhost TCP port if it is a number, Unix domain socket path otherwise
+    std::string address;
+    size_t threads;
+//    all sessions use one calculator instead of one each
+    bool shared;
+//    budget of the evaluation cache shared by all sessions; 0 disables it
+    size_t eval_cache_bytes;
+//    budget of the derivative store shared by all sessions; 0 disables it
+    uint64_t derivative_store_bytes;
+//    directory under which commands of clients read and write files, by
+//    relative names; empty disables file access
+    std::string files_dir;
+};
+
+//    runs until an error occurs; returns the exit status
+int serve(const ServerOptions& options);
@@ -0,0 +1,394 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    using Node::Ptr;
+    using Node::Kind;
+    using Node::Constant;
+    using Node::BinaryOp::Sum;
+    using Node::BinaryOp::Diff;
+    using Node::BinaryOp::Mult;
+    using Node::BinaryOp::Div;
+    using Node::BinaryOp::Pow;
+    using Node::UnaryFunc::Sin;
+    using Node::UnaryFunc::Cos;
+    using Node::UnaryFunc::Tan;
+    using Node::UnaryFunc::Cot;
+    using Node::UnaryFunc::Neg;
+    using Node::UnaryFunc::Ln;
+
+//    one pass is usually enough; the limit only guards against rules that
+//    undo each other
+    constexpr int MAX_PASSES = 8;
+
+    Ptr left_of(const Node::Key& key) {
+        return key.left->shared_from_this();
+    }
+    Ptr right_of(const Node::Key& key) {
+        return key.right->shared_from_this();
+    }
+    Ptr constant(double val) {
+        return Node::make<Constant>(val);
+    }
+//    exact, as folded constants may be tiny without being zero:
+//    x * 1e-6 * 1e-6 is 1e-12 * x
+    bool is_zero(double val) {
+        return val == 0;
+    }
+    bool is_one(double val) {
+        return val == 1;
+    }
+
+//    order of terms and factors in canonical form, so that a * b and b * a
+//    are one node: variables first by name, other nodes by kind and
+//    structural hash; neither depends on the order in which the process
+//    met the variables
+    bool precedes(const Ptr& a, const Ptr& b) {
+        Node::Key a_key = a->key();
+        Node::Key b_key = b->key();
+        if (a_key.kind != b_key.kind) {
+            return a_key.kind < b_key.kind;
+        }
+        if (a_key.kind == Kind::VARIABLE) {
+            return a_key.val != b_key.val
+                && Node::variable_name(a_key.val)
+                    < Node::variable_name(b_key.val);
+        }
+        return a->hash() < b->hash();
+    }
+//    nonzero entries of a list of terms or factors in canonical order
+    vector<pair<Ptr, double>> sorted(const vector<pair<Ptr, double>>& list) {
+        vector<pair<Ptr, double>> ret;
+        for (const auto& entry : list) {
+            if (!is_zero(entry.second)) {
+                ret.push_back(entry);
+            }
+        }
+        stable_sort(ret.begin(), ret.end(), [](auto& a, auto& b) {
+            return precedes(a.first, b.first);
+        });
+        return ret;
+    }
+
+//    coef * term, keeping a quotient as c * a / b rather than c * (a / b)
+    Ptr scaled(const Ptr& term, double coef) {
+        if (is_one(coef)) {
+            return term;
+        }
+        if (is_one(-coef)) {
+            return make_simplified<Neg>(term);
+        }
+        Node::Key key = term->key();
+        if (key.kind == Kind::DIV) {
+            return make_simplified<Div>(scaled(left_of(key), coef),
+                                        right_of(key));
+        }
+        return make_simplified<Mult>(constant(coef), term);
+    }
+
+//    linear combination of terms
+    class Terms {
+    public:
+        void add(const Ptr& node, double coef) {
+            Node::Key key = node->key();
+            switch (key.kind) {
+                case Kind::CONSTANT:
+                    constant_ += coef * *node->get_const_value();
+                    return;
+                case Kind::SUM:
+                    add(left_of(key), coef);
+                    add(right_of(key), coef);
+                    return;
+                case Kind::DIFF:
+                    add(left_of(key), coef);
+                    add(right_of(key), -coef);
+                    return;
+                case Kind::NEG:
+                    add(left_of(key), -coef);
+                    return;
+                case Kind::MULT:
+                    if (auto val = key.left->get_const_value()) {
+                        add_term(right_of(key), coef * *val);
+                        return;
+                    }
+                    break;
+                case Kind::DIV: {
+//                    the coefficient of a canonical quotient is in front of
+//                    its numerator
+                    Node::Key num = key.left->key();
+                    if (auto val = key.left->get_const_value();
+                        val.has_value() && !is_one(*val)) {
+                        add_term(make_simplified<Div>(constant(1),
+                                                      right_of(key)),
+                                 coef * *val);
+                        return;
+                    }
+                    if (num.kind == Kind::MULT) {
+                        if (auto val = num.left->get_const_value()) {
+                            add_term(make_simplified<Div>(right_of(num),
+                                                          right_of(key)),
+                                     coef * *val);
+                            return;
+                        }
+                    } else if (num.kind == Kind::NEG) {
+                        add_term(make_simplified<Div>(left_of(num),
+                                                      right_of(key)),
+                                 -coef);
+                        return;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            add_term(node, coef);
+        }
+
+//        led by the first positive term, or by the constant, so that
+//        nothing is negated needlessly: b - a rather than -(a) + b
+        Ptr build() const {
+            vector<pair<Ptr, double>> terms = sorted(terms_);
+            size_t lead = find_if(terms.begin(), terms.end(), [](auto& term) {
+                return term.second > 0;
+            }) - terms.begin();
+            bool constant_first = lead == terms.size() && constant_ > 0;
+            Ptr ret;
+            if (constant_first) {
+                ret = constant(constant_);
+            } else if (lead < terms.size()) {
+                ret = scaled(terms[lead].first, terms[lead].second);
+            }
+            for (size_t i = 0; i < terms.size(); i++) {
+                const auto& [term, coef] = terms[i];
+                if (i == lead) {
+                    continue;
+                }
+                if (ret == nullptr) {
+                    ret = scaled(term, coef);
+                } else if (coef < 0) {
+                    ret = make_simplified<Diff>(ret, scaled(term, -coef));
+                } else {
+                    ret = make_simplified<Sum>(ret, scaled(term, coef));
+                }
+            }
+            if (constant_first || is_zero(constant_)) {
+                return ret == nullptr ? constant(0) : ret;
+            }
+            if (ret == nullptr) {
+                return constant(constant_);
+            }
+            return constant_ < 0
+                ? make_simplified<Diff>(ret, constant(-constant_))
+                : make_simplified<Sum>(ret, constant(constant_));
+        }
+    private:
+        vector<pair<Ptr, double>> terms_;
+        unordered_map<const Node::Base*, size_t> index_;
+        double constant_ = 0;
+
+        void add_term(const Ptr& term, double coef) {
+            auto [it, inserted] = index_.try_emplace(term.get(), terms_.size());
+            if (inserted) {
+                terms_.emplace_back(term, coef);
+            } else {
+                terms_[it->second].second += coef;
+            }
+        }
+    };
+
+//    product of powers of bases, with constant numerator and denominator
+//    kept apart so that x / 3 stays exact
+    class Factors {
+    public:
+//        exp is always an integer: non-integer powers are not looked into
+        void add(const Ptr& node, double exp) {
+            Node::Key key = node->key();
+            switch (key.kind) {
+                case Kind::CONSTANT:
+                    (exp > 0 ? num_ : den_) *= pow(*node->get_const_value(),
+                                                   abs(exp));
+                    return;
+                case Kind::MULT:
+                    add(left_of(key), exp);
+                    add(right_of(key), exp);
+                    return;
+                case Kind::DIV:
+                    add(left_of(key), exp);
+                    add(right_of(key), -exp);
+                    return;
+                case Kind::NEG:
+                    if (fmod(exp, 2) != 0) {
+                        num_ = -num_;
+                    }
+                    add(left_of(key), exp);
+                    return;
+                case Kind::POW:
+                    if (auto val = key.right->get_const_value()) {
+                        if (*val == trunc(*val)) {
+                            add(left_of(key), exp * *val);
+                        } else {
+                            add_factor(left_of(key), exp * *val);
+                        }
+                        return;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            add_factor(node, exp);
+        }
+
+        Ptr build() const {
+            double num_val = num_;
+            double den_val = den_;
+            if (is_zero(num_val)) {
+                return constant(0);
+            }
+//            folded only when the quotient is exact
+            if (double q = num_val / den_val; fma(q, den_val, -num_val) == 0) {
+                num_val = q;
+                den_val = 1;
+            }
+            Ptr num, den;
+            for (const auto& [base, exp] : sorted(factors_)) {
+                Ptr factor = is_one(abs(exp))
+                    ? base
+                    : make_simplified<Pow>(base, constant(abs(exp)));
+                Ptr& side = exp > 0 ? num : den;
+                side = side == nullptr
+                    ? factor
+                    : make_simplified<Mult>(side, factor);
+            }
+            Ptr ret = num == nullptr ? constant(num_val) : scaled(num, num_val);
+            if (den == nullptr) {
+                return is_one(den_val)
+                    ? ret
+                    : make_simplified<Div>(ret, constant(den_val));
+            }
+            if (!is_one(den_val)) {
+                den = make_simplified<Mult>(constant(den_val), den);
+            }
+            return make_simplified<Div>(ret, den);
+        }
+    private:
+        vector<pair<Ptr, double>> factors_;
+        unordered_map<const Node::Base*, size_t> index_;
+        double num_ = 1;
+        double den_ = 1;
+
+        void add_factor(const Ptr& base, double exp) {
+            auto [it, inserted] = index_.try_emplace(base.get(),
+                                                     factors_.size());
+            if (inserted) {
+                factors_.emplace_back(base, exp);
+            } else {
+                factors_[it->second].second += exp;
+            }
+        }
+    };
+
+    Ptr collect_terms(const Ptr& node) {
+        Terms terms;
+        terms.add(node, 1);
+        return terms.build();
+    }
+    Ptr collect_factors(const Ptr& node) {
+        Factors factors;
+        factors.add(node, 1);
+        return factors.build();
+    }
+
+//    rewrites of a node whose children are canonical already
+    struct Rule {
+        Kind kind;
+        Ptr (*apply)(const Ptr& node);
+    };
+    const Rule RULES[] = {
+        {Kind::SUM, collect_terms},
+        {Kind::DIFF, collect_terms},
+        {Kind::NEG, collect_terms},
+        {Kind::MULT, collect_factors},
+        {Kind::DIV, collect_factors},
+        {Kind::POW, collect_factors},
+    };
+
+//    one bottom-up pass over a DAG, visiting every node once
+    class Canonicalizer {
+    public:
+        Ptr run(const Ptr& node) {
+            if (auto it = done_.find(node.get()); it != done_.end()) {
+                return it->second;
+            }
+            Node::Key key = node->key();
+            Ptr left = key.left ? run(left_of(key)) : nullptr;
+            Ptr right = key.right ? run(right_of(key)) : nullptr;
+            Ptr ret = rebuild(node, key, left, right);
+            Kind kind = ret->key().kind;
+            for (const Rule& rule : RULES) {
+                if (rule.kind == kind) {
+                    ret = rule.apply(ret);
+                    break;
+                }
+            }
+            done_.emplace(node.get(), ret);
+            return ret;
+        }
+    private:
+        unordered_map<const Node::Base*, Ptr> done_;
+
+        static Ptr rebuild(const Ptr& node, const Node::Key& key,
+                           const Ptr& left, const Ptr& right) {
+            if (left.get() == key.left && right.get() == key.right) {
+                return node;
+            }
+            switch (key.kind) {
+                case Kind::SUM:
+                    return make_simplified<Sum>(left, right);
+                case Kind::DIFF:
+                    return make_simplified<Diff>(left, right);
+                case Kind::MULT:
+                    return make_simplified<Mult>(left, right);
+                case Kind::DIV:
+                    return make_simplified<Div>(left, right);
+                case Kind::POW:
+                    return make_simplified<Pow>(left, right);
+                case Kind::SIN:
+                    return make_simplified<Sin>(left);
+                case Kind::COS:
+                    return make_simplified<Cos>(left);
+                case Kind::TAN:
+                    return make_simplified<Tan>(left);
+                case Kind::COT:
+                    return make_simplified<Cot>(left);
+                case Kind::NEG:
+                    return make_simplified<Neg>(left);
+                case Kind::LN:
+                    return make_simplified<Ln>(left);
+                case Kind::CONSTANT:
+                case Kind::VARIABLE:
+                    break;
+            }
+            throw logic_error("Unreachable code");
+        }
+    };
+}
+
+Node::Ptr canonicalize(const Node::Ptr& expr) {
+    Ptr ret = expr;
+    for (int i = 0; i < MAX_PASSES; i++) {
+        Ptr next = Canonicalizer().run(ret);
+        if (next == ret) {
+            break;
+        }
+        ret = move(next);
+    }
+    return ret;
+}
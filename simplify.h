@@ -0,0 +1,9 @@
+#pragma once
+
+#include "expression_tree.h"
+
+//    canonical form of an expression: chains of sums and products are
+//    flattened, constants collected, like terms and powers of one base
+//    merged, and the result rebuilt in a fixed order; the rules are applied
+//    until nothing changes, so x - x = 0 and y * x * x = x ^ 2 * y
+Node::Ptr canonicalize(const Node::Ptr& expr);
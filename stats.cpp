@@ -0,0 +1,157 @@
+#include "stats.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace Stats {
+    void Histogram::record(uint64_t ns) {
+        buckets_[bucket_of(ns)].fetch_add(1, memory_order_relaxed);
+        count_.fetch_add(1, memory_order_relaxed);
+    }
+    uint64_t Histogram::count() const {
+        return count_.load(memory_order_relaxed);
+    }
+    uint64_t Histogram::percentile(double fraction) const {
+        uint64_t total = 0;
+        for (const auto& bucket : buckets_) {
+            total += bucket.load(memory_order_relaxed);
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(fraction * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += buckets_[i].load(memory_order_relaxed);
+            if (seen > rank) {
+                return upper_bound(i);
+            }
+        }
+        return upper_bound(BUCKETS - 1);
+    }
+
+//    values below SUB_BUCKETS get a bucket each; larger ones are split by
+//    the position of the highest bit and the three bits after it
+    size_t Histogram::bucket_of(uint64_t ns) {
+        if (ns < SUB_BUCKETS) {
+            return ns;
+        }
+        int exp = 63 - __builtin_clzll(ns);
+        return (exp - 2) * SUB_BUCKETS + ((ns >> (exp - 3)) & (SUB_BUCKETS - 1));
+    }
+    uint64_t Histogram::upper_bound(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int exp = bucket / SUB_BUCKETS + 2;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exp - 3)) - 1;
+    }
+
+    Histogram& request_latency() {
+        static Histogram* ret = new Histogram;
+        return *ret;
+    }
+
+    CacheCounters& derivative_cache() {
+        static CacheCounters* ret = new CacheCounters;
+        return *ret;
+    }
+
+    CacheCounters& eval_cache() {
+        static CacheCounters* ret = new CacheCounters;
+        return *ret;
+    }
+
+    CacheCounters& derivative_store() {
+        static CacheCounters* ret = new CacheCounters;
+        return *ret;
+    }
+
+    Histogram& stage_latency(Stage stage) {
+        static auto* ret = new array<Histogram, STAGE_COUNT>;
+        return (*ret)[static_cast<size_t>(stage)];
+    }
+    void enable_stage_timing(bool enabled) {
+        stage_timing.store(enabled, memory_order_relaxed);
+    }
+
+    namespace {
+        constexpr array<pair<Stage, const char*>, STAGE_COUNT> STAGE_NAMES = {{
+            {Stage::PARSE, "parse"},
+            {Stage::SIMPLIFY, "simplify"},
+            {Stage::DERIVE, "derive"},
+            {Stage::EVALUATE, "evaluate"},
+            {Stage::PRINT, "print"},
+            {Stage::COMMAND, "command"}
+        }};
+
+        void print_counters(ostream& out, const char* name,
+                            const CacheCounters& counters) {
+            out << name << ": " << counters.hits.load() << " hits, "
+                << counters.misses.load() << " misses\n";
+        }
+        void print_histogram(ostream& out, const char* name,
+                             const Histogram& histogram) {
+            out << name << ": " << histogram.count();
+            for (auto [label, fraction] : {
+                pair{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p99.9", 0.999}
+            }) {
+                out << ' ' << label << ' '
+                    << histogram.percentile(fraction) / 1000.0 << "us";
+            }
+            out << '\n';
+        }
+    }
+
+    void print(ostream& out) {
+        print_histogram(out, "requests", request_latency());
+        print_counters(out, "derivative cache", derivative_cache());
+        print_counters(out, "eval cache", eval_cache());
+        print_counters(out, "derivative store", derivative_store());
+        if (stage_timing.load(memory_order_relaxed)) {
+            for (auto [stage, name] : STAGE_NAMES) {
+                print_histogram(out, name, stage_latency(stage));
+            }
+        }
+    }
+
+    PeriodicDump::PeriodicDump(string path, chrono::seconds interval)
+    : path_(move(path)), interval_(interval),
+      thread_(&PeriodicDump::run, this) {}
+    PeriodicDump::~PeriodicDump() {
+        {
+            lock_guard lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        dump();
+    }
+
+    void PeriodicDump::run() {
+        unique_lock lock(mtx_);
+        while (!cv_.wait_for(lock, interval_, [this] { return stop_; })) {
+            dump();
+        }
+    }
+//    written next to the file and renamed over it, so that readers never
+//    see a partial dump
+    void PeriodicDump::dump() const {
+        string tmp = path_ + ".tmp";
+        {
+            ofstream out(tmp);
+            print(out);
+            if (!out) {
+                cerr << "Cannot write " << tmp << endl;
+                return;
+            }
+        }
+        if (rename(tmp.c_str(), path_.c_str()) != 0) {
+            cerr << "Cannot write " << path_ << endl;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace Stats {
+//    lock-free histogram of durations in nanoseconds with buckets of about
+//    12% relative width, enough for latency percentiles
+    class Histogram {
+    public:
+        void record(uint64_t ns);
+        uint64_t count() const;
+//        upper bound of the bucket holding the given fraction of records
+        uint64_t percentile(double fraction) const;
+    private:
+        static constexpr size_t SUB_BUCKETS = 8;
+        static constexpr size_t BUCKETS = 64 * SUB_BUCKETS;
+
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+        std::atomic<uint64_t> count_{0};
+
+        static size_t bucket_of(uint64_t ns);
+        static uint64_t upper_bound(size_t bucket);
+    };
+
+    struct CacheCounters {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+//    time from receiving a command in server mode to its response
+    Histogram& request_latency();
+//    lookups of derivatives of saved expressions by order
+    CacheCounters& derivative_cache();
+//    evaluations of saved expressions at points, if they are cached
+    CacheCounters& eval_cache();
+//    lookups of derivatives on disk, if they are stored
+    CacheCounters& derivative_store();
+
+//    stages of commands timed when stage timing is enabled
+    enum class Stage {
+        PARSE, SIMPLIFY, DERIVE, EVALUATE, PRINT, COMMAND
+    };
+    constexpr size_t STAGE_COUNT = 6;
+    Histogram& stage_latency(Stage stage);
+
+//    off by default; when off, timers do not read the clock
+    inline std::atomic<bool> stage_timing{false};
+    void enable_stage_timing(bool enabled);
+
+//    records the time from construction to destruction in the histogram
+//    of the stage
+    class Timer {
+    public:
+        explicit Timer(Stage stage)
+        : stage_(stage),
+          active_(stage_timing.load(std::memory_order_relaxed)) {
+            if (active_) {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer() {
+            if (active_) {
+                stage_latency(stage_).record(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_
+                    ).count()
+                );
+            }
+        }
+    private:
+        Stage stage_;
+        bool active_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+//    output of the STATS command
+    void print(std::ostream& out);
+
+//    rewrites the file with the output of STATS every interval, and once
+//    more when destroyed
+    class PeriodicDump {
+    public:
+        PeriodicDump(std::string path, std::chrono::seconds interval);
+        PeriodicDump(const PeriodicDump&) = delete;
+        PeriodicDump& operator=(const PeriodicDump&) = delete;
+        ~PeriodicDump();
+    private:
+        std::string path_;
+        std::chrono::seconds interval_;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+        std::thread thread_;
+
+        void run();
+        void dump() const;
+    };
+}
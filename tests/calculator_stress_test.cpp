@@ -0,0 +1,93 @@
+#include "calculator.h"
+#include "expression.h"
+#include "tests/check.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//    writers call DER and SAVE on one calculator while readers take
+//    snapshots of it; every snapshot must be a version some sequence of
+//    the calls published, and no call may be lost
+namespace {
+    constexpr int POWER = 12;
+    constexpr int DER_WRITERS = 2;
+    constexpr int DERS_PER_WRITER = 5;
+    constexpr int SAVES = 20;
+    constexpr int READERS = 2;
+    constexpr int ROUNDS = 200;
+
+//    x^POWER and its derivatives at 1 are POWER! / (POWER - k)!, distinct
+//    for every order k, so a value tells the order
+    int order_of(double value) {
+        double expected = 1;
+        for (int k = 0; k <= POWER; k++) {
+            if (value == expected) {
+                return k;
+            }
+            expected *= POWER - k;
+        }
+        return -1;
+    }
+
+    void check_snapshot(const Calculator& calc) {
+//        a copy is one version, so its parts must agree
+        Calculator snapshot(calc);
+        Node::Ptr last = snapshot.get();
+        int order = order_of(last->evaluate(1));
+        CHECK(order >= 0 && order <= DER_WRITERS * DERS_PER_WRITER);
+        CHECK(snapshot.program()->evaluate(1) == last->evaluate(1));
+        CHECK(snapshot.evaluate(1) == last->evaluate(1));
+        for (const auto& [name, tree] : snapshot.session().vars) {
+//            saved from an earlier or the same last; DER only goes up
+            int saved = order_of(tree->evaluate(1));
+            CHECK(saved >= 0 && saved <= order);
+            CHECK(snapshot.evaluate(name, 1) == tree->evaluate(1));
+        }
+    }
+
+    void round() {
+        Calculator calc;
+        calc.new_expr(parse_expression("x^" + to_string(POWER)));
+        calc.save("f");
+        atomic<int> writing{DER_WRITERS + 1};
+        vector<thread> threads;
+        for (int i = 0; i < DER_WRITERS; i++) {
+            threads.emplace_back([&] {
+                for (int k = 0; k < DERS_PER_WRITER; k++) {
+                    calc.derivative();
+                }
+                writing--;
+            });
+        }
+        threads.emplace_back([&] {
+            for (int k = 0; k < SAVES; k++) {
+                calc.save("s" + to_string(k));
+            }
+            writing--;
+        });
+        for (int i = 0; i < READERS; i++) {
+            threads.emplace_back([&] {
+                do {
+                    check_snapshot(calc);
+                } while (writing > 0);
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        check_snapshot(calc);
+        CHECK(order_of(calc.get()->evaluate(1))
+              == DER_WRITERS * DERS_PER_WRITER);
+    }
+}
+
+int main() {
+    for (int i = 0; i < ROUNDS; i++) {
+        round();
+    }
+    return failures() != 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <iostream>
+
+//    counts failed checks; a test exits with failures() != 0
+inline int& failures() {
+    static int ret = 0;
+    return ret;
+}
+
+#define CHECK(cond)                                                      \
+    do {                                                                 \
+        if (!(cond)) {                                                   \
+            std::cerr << __FILE__ << ':' << __LINE__ << ": " #cond "\n"; \
+            failures()++;                                                \
+        }                                                                \
+    } while (false)
@@ -0,0 +1,103 @@
+#include "calculator.h"
+#include "eval_cache.h"
+#include "expression.h"
+#include "stats.h"
+#include "tests/check.h"
+
+#include <memory>
+
+using namespace std;
+
+namespace {
+//    two entries of 64 bytes in each of the 64 shards
+    constexpr size_t SMALL_CACHE = 2 * 64 * 64;
+    constexpr int INSERTS = 10000;
+
+    uint64_t hits() {
+        return Stats::eval_cache().hits;
+    }
+    uint64_t misses() {
+        return Stats::eval_cache().misses;
+    }
+}
+
+int main() {
+    {
+        EvalCache cache(1 << 20);
+        uint64_t f = EvalCache::new_id();
+        uint64_t g = EvalCache::new_id();
+        CHECK(f != g);
+        double value = 0;
+        CHECK(!cache.find(f, 1, value));
+        cache.insert(f, 1, 2);
+        CHECK(cache.find(f, 1, value) && value == 2);
+//        keyed by the bits of x and by the expression
+        CHECK(!cache.find(f, -0.0, value));
+        cache.insert(f, 0.0, 3);
+        CHECK(!cache.find(f, -0.0, value));
+        CHECK(!cache.find(g, 1, value));
+        cache.insert(f, 1, 4);
+        CHECK(cache.find(f, 1, value) && value == 4);
+    }
+    {
+//        nothing fits, so nothing is kept
+        EvalCache cache(64);
+        double value;
+        cache.insert(1, 1, 1);
+        CHECK(!cache.find(1, 1, value));
+    }
+    {
+//        the memory budget holds however many entries are inserted, and an
+//        entry referenced between every two inserts is never evicted
+        EvalCache cache(SMALL_CACHE);
+        uint64_t f = EvalCache::new_id();
+        uint64_t g = EvalCache::new_id();
+        double value;
+        cache.insert(g, 0, 1);
+        for (int i = 1; i <= INSERTS; i++) {
+            cache.insert(f, i, i);
+            CHECK(cache.find(g, 0, value) && value == 1);
+        }
+        int kept = 0;
+        for (int i = 1; i <= INSERTS; i++) {
+            kept += cache.find(f, i, value);
+        }
+        CHECK(kept > 0 && kept < static_cast<int>(SMALL_CACHE / 64));
+//        and an entry no longer referenced is evicted in time
+        for (int i = 1; i <= INSERTS; i++) {
+            cache.insert(f, -i, -i);
+        }
+        CHECK(!cache.find(g, 0, value));
+    }
+    {
+//        evaluations of saved expressions hit the cache until the name is
+//        saved again
+        Calculator calc(make_shared<EvalCache>(1 << 20));
+        calc.new_expr(parse_expression("x^2"));
+        calc.save("f");
+        uint64_t h = hits();
+        uint64_t m = misses();
+        CHECK(calc.evaluate("f", 3) == 9);
+        CHECK(hits() == h && misses() == m + 1);
+        CHECK(calc.evaluate("f", 3) == 9);
+        CHECK(hits() == h + 1 && misses() == m + 1);
+        double xs[] = {3, 4};
+        double out[2];
+        calc.evaluate_batch("f", xs, out, 2);
+        CHECK(out[0] == 9 && out[1] == 16);
+        CHECK(hits() == h + 2 && misses() == m + 2);
+
+        calc.new_expr(parse_expression("x^3"));
+        calc.save("f");
+        CHECK(calc.evaluate("f", 3) == 27);
+        CHECK(hits() == h + 2 && misses() == m + 3);
+        calc.evaluate_batch("f", xs, out, 2);
+        CHECK(out[0] == 27 && out[1] == 64);
+
+//        copies share the cache
+        Calculator copy(calc);
+        CHECK(copy.evaluate("f", 4) == 64);
+        CHECK(hits() == h + 4);
+    }
+    return failures() != 0;
+}
@@ -0,0 +1,54 @@
+#include "bytecode.h"
+#include "expression.h"
+#include "integrate.h"
+#include "tests/check.h"
+
+#include <cmath>
+#include <string>
+
+using namespace std;
+
+namespace {
+    constexpr double TOLERANCE = 1e-10;
+
+    Integral integral_of(const string& in, double a, double b) {
+        return integrate(Bytecode::compile(parse_expression(in).get()),
+                         a, b, TOLERANCE);
+    }
+
+//    converged, within the tolerance of the closed form, and with an error
+//    estimate that covers the actual error
+    bool matches(const string& in, double a, double b, double expected) {
+        Integral integral = integral_of(in, a, b);
+        double error = abs(integral.value - expected);
+        return integral.converged
+            && error <= TOLERANCE * max(1.0, abs(expected))
+            && error <= integral.error + 1e-14 * max(1.0, abs(expected));
+    }
+}
+
+int main() {
+    CHECK(matches("x^2", 0, 3, 9));
+    CHECK(matches("x^2", 3, 0, -9));
+    CHECK(matches("sin(x)", 0, M_PI, 2));
+    CHECK(matches("cos(x)", 0, 100, sin(100)));
+    CHECK(matches("1/x", 1, M_E, 1));
+    CHECK(matches("ln(x)", 1, 2, 2 * log(2) - 1));
+    CHECK(matches("1/(1 + x^2)", -1e3, 1e3, 2 * atan(1e3)));
+    CHECK(matches("x^0.5", 0, 1, 2.0 / 3));
+    CHECK(matches("x^7 - 3*x", -2, 2, 0));
+
+//    polynomials up to degree 13 are exact with the Gauss rule as well, so
+//    one interval is enough
+    Integral integral = integral_of("x^12 + x^13", -1, 1);
+    CHECK(integral.evaluations == 15);
+    CHECK(abs(integral.value - 2.0 / 13) <= 1e-15);
+
+    integral = integral_of("x", 1, 1);
+    CHECK(integral.converged && integral.value == 0);
+
+//    a pole inside the interval does not converge
+    integral = integral_of("1/x", -1, 2);
+    CHECK(!integral.converged);
+    return failures() != 0;
+}
@@ -0,0 +1,92 @@
+#include "calculator.h"
+#include "expression.h"
+#include "tests/check.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    const vector<string> EXPRESSIONS = {
+        "x^2 - 2*x + 1",
+        "sin(x)*cos(x) + tan(x/3)",
+        "ln(x^2 + 1) / (x - 0.5)",
+        "cot(x) - x^x",
+        "(x^3 + 1)^0.5 * sin(x^2)",
+        "1/x",
+        "ln(x)",
+    };
+    const vector<double> POINTS = {
+        -3, -1, -0.5, -1e-300, 0, 1e-300, 0.5, 1, 2.5, 7, 1e3
+    };
+
+//    bit for bit, with every NaN alike
+    bool same(double a, double b) {
+        return (isnan(a) && isnan(b)) || memcmp(&a, &b, sizeof(a)) == 0;
+    }
+
+//    the values and batches of f before COMPILE, compared with those
+//    after; compiled derivatives are those of the symbolic derivative
+//    rather than of the forward sweep, so they are compared with it
+    bool compiled_matches(Calculator& calc) {
+        Bytecode::Program der = Bytecode::compile(calc.derivative("f").get());
+        vector<double> values;
+        for (double x : POINTS) {
+            values.push_back(calc.evaluate("f", x));
+        }
+        vector<double> batch(POINTS.size());
+        calc.evaluate_batch("f", POINTS.data(), batch.data(), POINTS.size());
+        calc.compile("f");
+        vector<double> compiled_batch(POINTS.size());
+        calc.evaluate_batch("f", POINTS.data(), compiled_batch.data(),
+                            POINTS.size());
+        bool ret = true;
+        for (size_t i = 0; i < POINTS.size(); i++) {
+            Node::Dual dual = calc.evaluate_dual("f", POINTS[i]);
+            ret = ret && same(calc.evaluate("f", POINTS[i]), values[i])
+                && same(dual.value, values[i])
+                && same(dual.derivative, der.evaluate(POINTS[i]))
+                && same(compiled_batch[i], batch[i]);
+        }
+        return ret;
+    }
+}
+
+int main() {
+//    libraries are built in a cache directory of this test only
+    char dir[] = "/tmp/jit_test.XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", dir, 1);
+
+    for (const string& in : EXPRESSIONS) {
+        Calculator calc;
+        calc.new_expr(parse_expression(in));
+        calc.save("f");
+        CHECK(compiled_matches(calc));
+//        and once more from the library cached on disk
+        Calculator again;
+        again.new_expr(parse_expression(in));
+        again.save("f");
+        CHECK(compiled_matches(again));
+    }
+
+//    a compiled expression saved again is interpreted until compiled
+    Calculator calc;
+    calc.new_expr(parse_expression("x^2"));
+    calc.save("f");
+    calc.compile("f");
+    calc.new_expr(parse_expression("x^3"));
+    calc.save("f");
+    CHECK(calc.evaluate("f", 2) == 8);
+    CHECK(compiled_matches(calc));
+
+    filesystem::remove_all(dir);
+    return failures() != 0;
+}
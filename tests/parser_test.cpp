@@ -0,0 +1,89 @@
+#include "expression.h"
+#include "tests/check.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+    string print(const string& in) {
+        ostringstream out;
+        out << parse_expression(in).get();
+        return out.str();
+    }
+
+//    nodes are interned, so equal canonical forms are the same node
+    bool same(const string& left, const string& right) {
+        bool ret = parse_expression(left) == parse_expression(right);
+        if (!ret) {
+            cerr << left << " -> " << print(left) << ", " << right << " -> "
+                 << print(right) << '\n';
+        }
+        return ret;
+    }
+
+    bool rejected(const string& in) {
+        try {
+            parse_expression(in);
+        } catch (const invalid_argument&) {
+            return true;
+        }
+        cerr << in << " -> " << print(in) << '\n';
+        return false;
+    }
+}
+
+int main() {
+    CHECK(same("1+2*3^2", "1+(2*(3^2))"));
+    CHECK(same("2^3^2", "2^(3^2)"));
+    CHECK(same("x-y-1", "(x-y)-1"));
+    CHECK(same("x/y/2", "(x/y)/2"));
+
+//    unary minus and functions apply to the braces right after them, or
+//    else to the rest of the enclosing braces
+    CHECK(same("-x+1", "-(x+1)"));
+    CHECK(!same("-x+1", "(-x)+1"));
+    CHECK(same("-2*x+1", "-(2*x+1)"));
+    CHECK(same("-sin(x)+1", "-(sin(x)+1)"));
+    CHECK(same("(-x+1)*2", "(-(x+1))*2"));
+    CHECK(same("-(x)+1", "(-x)+1"));
+    CHECK(same("-x^2", "-(x^2)"));
+    CHECK(same("-(x)^2", "(-x)^2"));
+    CHECK(same("x+(-x)*3", "x+(-(x*3))"));
+    CHECK(same("sin(x)^2", "(sin(x))^2"));
+    CHECK(same("sin(x)+1", "(sin(x))+1"));
+    CHECK(same("sin x", "sin(x)"));
+    CHECK(same("sin x + 1", "sin(x+1)"));
+    CHECK(same("2*sin x + 1", "2*sin(x+1)"));
+    CHECK(same("2*sin(x) + 1", "(2*sin(x))+1"));
+    CHECK(same("cos sin(x)*2", "cos(sin(x)*2)"));
+    CHECK(same("sin(-x)", "sin(-(x))"));
+
+//    a function name followed by letters is a variable
+    CHECK(print("sinx") == "sinx");
+    CHECK(!same("sinx", "sin(x)"));
+
+//    unary minus only opens the input or a brace
+    CHECK(rejected("x--x"));
+    CHECK(rejected("x+-x"));
+    CHECK(rejected("2*-x"));
+    CHECK(rejected("x*-1+2"));
+    CHECK(rejected("2^-x"));
+    CHECK(rejected("x^-1"));
+    CHECK(rejected("--x"));
+    CHECK(rejected("sin -x"));
+
+    CHECK(rejected(""));
+    CHECK(rejected("-"));
+    CHECK(rejected("sin"));
+    CHECK(rejected("()"));
+    CHECK(rejected("x+"));
+    CHECK(rejected("(x"));
+    CHECK(rejected("x)"));
+    CHECK(rejected("x y"));
+    CHECK(rejected("sin(x)(y)"));
+    CHECK(rejected("x*/y"));
+    return failures() != 0;
+}
@@ -0,0 +1,78 @@
+#include "bytecode.h"
+#include "expression.h"
+#include "range.h"
+#include "tests/check.h"
+
+#include <cmath>
+#include <string>
+
+using namespace std;
+
+namespace {
+    constexpr size_t SAMPLES = 1000;
+
+    Interval::Bounds range_of(const string& in, double a, double b) {
+        Node::Ptr expr = parse_expression(in);
+        return range(Bytecode::compile(expr.get()),
+                     Bytecode::compile(derivative(expr.get()).get()), a, b);
+    }
+
+//    every defined value at points sampled in [a, b] lies within the
+//    bounds, and undefined ones only if the bounds are partial
+    bool encloses(const string& in, double a, double b) {
+        Interval::Bounds bounds = range_of(in, a, b);
+        Bytecode::Program program = Bytecode::compile(
+            parse_expression(in).get()
+        );
+        for (size_t i = 0; i <= SAMPLES; i++) {
+            double x = a + (b - a) * (static_cast<double>(i) / SAMPLES);
+            double value = program.evaluate(x);
+            if (isnan(value) || isinf(value)) {
+                if (!bounds.partial) {
+                    return false;
+                }
+            } else if (!(bounds.lo <= value && value <= bounds.hi)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool near(double value, double expected) {
+        return abs(value - expected) <= 1e-6 * max(1.0, abs(expected));
+    }
+}
+
+int main() {
+    CHECK(encloses("x^2 - 2", -3, 3));
+    CHECK(encloses("sin(x)", 0, 10));
+    CHECK(encloses("x*sin(x) + cos(3*x)", -5, 5));
+    CHECK(encloses("x^3 - x", -1e-3, 1e-3));
+    CHECK(encloses("1/x", -1, 1));
+    CHECK(encloses("tan(x)", 1, 5));
+    CHECK(encloses("ln(x)", -1, 2));
+    CHECK(encloses("x^0.5", -1, 4));
+
+//    bounds are tight
+    Interval::Bounds bounds = range_of("x^2 - 2", -3, 3);
+    CHECK(near(bounds.lo, -2) && near(bounds.hi, 7));
+    CHECK(!bounds.partial);
+    bounds = range_of("sin(x)", 0, 10);
+    CHECK(near(bounds.lo, -1) && near(bounds.hi, 1));
+
+//    poles and domains of ln and pow
+    bounds = range_of("1/x", -1, 1);
+    CHECK(bounds.partial);
+    CHECK(bounds.lo == -INFINITY && bounds.hi == INFINITY);
+    bounds = range_of("1/x", 1, 2);
+    CHECK(!bounds.partial);
+    CHECK(near(bounds.lo, 0.5) && near(bounds.hi, 1));
+    bounds = range_of("ln(x)", -1, 2);
+    CHECK(bounds.partial);
+    CHECK(bounds.lo == -INFINITY && near(bounds.hi, log(2)));
+    CHECK(range_of("ln(x)", -2, -1).empty());
+    bounds = range_of("x^0.5", -1, 4);
+    CHECK(bounds.partial);
+    CHECK(near(bounds.lo, 0) && near(bounds.hi, 2));
+    return failures() != 0;
+}
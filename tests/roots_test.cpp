@@ -0,0 +1,61 @@
+#include "bytecode.h"
+#include "expression.h"
+#include "roots.h"
+#include "tests/check.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    vector<Root> roots_of(const string& in, double a, double b) {
+        Node::Ptr expr = parse_expression(in);
+        return roots(Bytecode::compile(expr.get()),
+                     Bytecode::compile(derivative(expr.get()).get()), a, b);
+    }
+
+//    the roots found are single points near the expected ones, in order
+    bool finds(const string& in, double a, double b,
+               const vector<double>& expected) {
+        vector<Root> found = roots_of(in, a, b);
+        if (found.size() != expected.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < found.size(); i++) {
+            if (found[i].lo != found[i].hi
+                || abs(found[i].lo - expected[i]) > 1e-9) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main() {
+    CHECK(finds("x^2 - 2", -3, 3, {-sqrt(2), sqrt(2)}));
+    CHECK(finds("sin(x)", 1, 10, {M_PI, 2 * M_PI, 3 * M_PI}));
+    CHECK(finds("x^3 - 6*x^2 + 11*x - 6", 0, 4, {1, 2, 3}));
+    CHECK(finds("ln(x) - 1", 0.5, 5, {M_E}));
+    CHECK(finds("x - 1e6", 0, 2e6, {1e6}));
+    CHECK(finds("x", 0, 0, {0}));
+
+//    poles change sign too, but are no roots
+    CHECK(roots_of("1/x", -1, 1).empty());
+    CHECK(finds("tan(x)", 1, 5, {M_PI}));
+
+//    a double root is found where it is sampled, here at -3 + 6 * 2730/4095,
+//    and a triple root, where the sign changes, anywhere
+    CHECK(finds("(x - 1)^2", -3, 3, {1}));
+    CHECK(finds("(x - 0.3)^3", -1, 1, {0.3}));
+//    otherwise roots without a sign change are missed, but nothing else is
+//    taken for them
+    CHECK(roots_of("x^2", -1, 1).empty());
+    CHECK(roots_of("x^2 + 1", -3, 3).empty());
+
+//    runs of zeros are intervals
+    vector<Root> found = roots_of("x - x", 0, 1);
+    CHECK(found.size() == 1 && found[0].lo == 0 && found[0].hi == 1);
+    return failures() != 0;
+}
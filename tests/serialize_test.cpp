@@ -0,0 +1,44 @@
+#include "expression.h"
+#include "serialize.h"
+#include "tests/check.h"
+
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace {
+    bool decodes(const Serialize::Session& session) {
+        try {
+            Serialize::decode(Serialize::encode(session));
+        } catch (const runtime_error&) {
+            return false;
+        }
+        return true;
+    }
+
+    Node::Ptr variable(const string& name) {
+        return Node::make<Node::Variable>(Node::variable_index(name));
+    }
+}
+
+int main() {
+    Node::Ptr expr = parse_expression("x^2 + y_1*sin(x)");
+    Serialize::Session session{expr, {{"f", expr}, {"g2", expr}}};
+    Serialize::Session back = Serialize::decode(Serialize::encode(session));
+    CHECK(back.last == expr);
+    CHECK(back.vars == session.vars);
+
+//    names no command could make are refused
+    CHECK(!decodes({expr, {{"", expr}}}));
+    CHECK(!decodes({expr, {{"2f", expr}}}));
+    CHECK(!decodes({expr, {{"a b", expr}}}));
+    CHECK(!decodes({expr, {{"f\n", expr}}}));
+    CHECK(!decodes({variable("sin"), {}}));
+    CHECK(!decodes({variable("x y"), {}}));
+    CHECK(!decodes({variable("1x"), {}}));
+    CHECK(!decodes({variable("x-y"), {}}));
+    CHECK(!decodes({variable("../x"), {}}));
+    CHECK(decodes({variable("x_1"), {{"f", variable("abc")}}}));
+    return failures() != 0;
+}
@@ -0,0 +1,47 @@
+#include "expression.h"
+#include "tests/check.h"
+
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace {
+    string print(const string& in) {
+        ostringstream out;
+        out << parse_expression(in).get();
+        return out.str();
+    }
+
+    double eval(const string& in, double x) {
+        return parse_expression(in)->evaluate(x);
+    }
+}
+
+int main() {
+//    small coefficients are kept, however they are folded
+    CHECK(print("x*1e-12") != "0");
+    CHECK(print("x*1e-6*1e-6") != "0");
+    CHECK(eval("x*1e-6*1e-6", 2) == 2e-12);
+    CHECK(eval("1e-6*x*1e-6*x", 3) == 9e-12);
+    CHECK(eval("x^3 - 1e-30", 0) == -1e-30);
+    CHECK(eval("1e-11 + x - x", 5) == 1e-11);
+    CHECK(eval("x*(1 + 1e-12)", 1) == 1 + 1e-12);
+    CHECK(eval("x^(1 + 1e-12)", 2) != 2);
+    CHECK(eval("1e-200 * 1e-200 * x + 1", 1) == 1);
+
+//    exact zeros and ones still vanish
+    CHECK(print("x*0 + 1") == "1");
+    CHECK(print("x - x") == "0");
+    CHECK(print("1*x") == "x");
+    CHECK(print("x^1") == "x");
+    CHECK(print("x^0") == "1");
+
+//    variables are ordered by name, whichever the process saw first
+    CHECK(print("z*2") == "2 * z");
+    CHECK(print("y+z") == "y + z");
+    CHECK(print("z+y") == "y + z");
+    CHECK(print("w3*v3") == "v3 * w3");
+    CHECK(print("v3*w3") == "v3 * w3");
+    return failures() != 0;
+}
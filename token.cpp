@@ -1,7 +1,13 @@
 #include "token.h"
 
-#include <variant>
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <charconv>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <variant>
 
 using namespace std;
 
@@ -30,111 +36,153 @@ ostream& operator<<(ostream& out, const Brace& brace) {
     };
 }
 ostream& operator<<(ostream& out, const Variable& var) {
-    return out << 'x';
+    return out << var.name;
 }
 
-optional<double> try_make_constant(istream& in) {
-    if (isdigit(in.peek())) {
-        double d;
-        in >> d;
-        return d;
+namespace {
+    bool is_alpha(char c) {
+        return isalpha(static_cast<unsigned char>(c));
+    }
+    bool is_digit(char c) {
+        return isdigit(static_cast<unsigned char>(c));
+    }
+    bool is_identifier_char(char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_';
     }
-    return nullopt;
 }
-optional<Variable> try_make_variable(istream& in) {
-    if (in.get() == 'x' && (in.eof() || !isalpha(in.peek()))) {
-        return Variable();
+
+optional<double> try_make_constant(string_view& in) {
+    if (!is_digit(in[0])) {
+        return nullopt;
+    }
+    double d;
+    auto [end, ec] = from_chars(in.data(), in.data() + in.size(), d);
+    if (ec == errc::result_out_of_range) {
+        throw invalid_argument("Number out of range: "
+                               + string(in.substr(0, end - in.data())));
+    }
+    in.remove_prefix(end - in.data());
+    return d;
+}
+optional<string_view> try_read_identifier(string_view& in) {
+    if (!is_alpha(in[0])) {
+        return nullopt;
     }
-    in.unget();
-    return nullopt;
+    size_t len = 1;
+    while (len < in.size() && is_identifier_char(in[len])) {
+        len++;
+    }
+    string_view ret = in.substr(0, len);
+    in.remove_prefix(len);
+    return ret;
 }
-BinaryOp::Ptr try_make_binary_op(istream& in) {
-    switch (in.get()) {
+optional<BinaryOp::Type> try_make_binary_op(string_view& in) {
+    optional<BinaryOp::Type> ret;
+    switch (in[0]) {
         case '+':
-            return make_unique<BinaryOp::Sum>();
+            ret = BinaryOp::Type::SUM;
+            break;
         case '-':
-            return make_unique<BinaryOp::Diff>();
+            ret = BinaryOp::Type::DIFF;
+            break;
         case '*':
-            return make_unique<BinaryOp::Mult>();
+            ret = BinaryOp::Type::MULT;
+            break;
         case '/':
-            return make_unique<BinaryOp::Div>();
+            ret = BinaryOp::Type::DIV;
+            break;
         case '^':
-            return make_unique<BinaryOp::Pow>();
+            ret = BinaryOp::Type::POW;
+            break;
         default:
-            in.unget();
-            return nullptr;
+            return nullopt;
     }
+    in.remove_prefix(1);
+    return ret;
 }
-optional<UnaryFunc> try_make_unary_func(istream& in) {
-    string name = "";
-    while (!in.eof() && isalpha(in.peek())) {
-        name += in.get();
-    }
-    if (name == "sin") {
-        return UnaryFunc::SIN;
-    } else if (name == "cos") {
-        return UnaryFunc::COS;
-    } else if (name == "tan") {
-        return UnaryFunc::TAN;
-    } else if (name == "cot") {
-        return UnaryFunc::COT;
-    } else if (name == "ln") {
-        return UnaryFunc::LN;
-    }
-    for (int i = 0; i < name.size(); i++) {
-        in.unget();
+//    dispatches on length and letters instead of comparing with every name
+optional<UnaryFunc> try_make_unary_func(string_view name) {
+    if (name.size() == 2) {
+        if (name == "ln") {
+            return UnaryFunc::LN;
+        }
+    } else if (name.size() == 3) {
+        switch (name[0]) {
+            case 's':
+                if (name == "sin") {
+                    return UnaryFunc::SIN;
+                }
+                break;
+            case 't':
+                if (name == "tan") {
+                    return UnaryFunc::TAN;
+                }
+                break;
+            case 'c':
+                if (name == "cos") {
+                    return UnaryFunc::COS;
+                } else if (name == "cot") {
+                    return UnaryFunc::COT;
+                }
+                break;
+        }
     }
     return nullopt;
 }
-optional<Brace> try_make_brace(istream& in) {
-    switch (in.get()) {
+optional<Brace> try_make_brace(string_view& in) {
+    optional<Brace> ret;
+    switch (in[0]) {
         case '(':
-            return Brace::OPEN;
+            ret = Brace::OPEN;
+            break;
         case ')':
-            return Brace::CLOSE;
+            ret = Brace::CLOSE;
+            break;
         default:
-            in.unget();
             return nullopt;
     }
+    in.remove_prefix(1);
+    return ret;
 }
 
-bool Token::operator==(const BinaryOp::Type& type) const {
-    return std::holds_alternative<BinaryOp::Ptr>(*this)
-        && std::get<BinaryOp::Ptr>(*this)->get_type() == type;
-}
-
-istream& operator>>(istream& in, Token& token) {
+Token read_token(string_view& in) {
+    assert(!in.empty());
+    
     if (auto d = try_make_constant(in); d) {
-        token = *d;
-        return in;
+        return *d;
     }
-    if (auto var = try_make_variable(in); var) {
-        token = *var;
-        return in;
+//    any identifier that is not a function name is a variable
+    if (auto name = try_read_identifier(in); name) {
+        if (auto func = try_make_unary_func(*name); func) {
+            return *func;
+        }
+        return Variable{*name};
     }
     if (auto op = try_make_binary_op(in); op) {
-        token = move(op);
-        return in;
-    }
-    if (auto func = try_make_unary_func(in); func) {
-        token = *func;
-        return in;
+        return *op;
     }
     if (auto brace = try_make_brace(in); brace) {
-        token = *brace;
-        return in;
+        return *brace;
     }
     
-    assert(!in.eof());
-    
-    string invalid_token;
-    if (!isalpha(in.peek())) {
-        invalid_token += in.peek();
+    throw invalid_argument("Invalid token: " + string(1, in[0]));
+}
+bool is_variable_name(string_view name) {
+    if (name.empty()) {
+        return false;
     }
-    while (!in.eof() && isalpha(in.peek())) {
-        invalid_token += in.get();
+    try {
+        Token token = read_token(name);
+        return name.empty() && holds_alternative<Variable>(token);
+    } catch (const invalid_argument&) {
+        return false;
     }
-    throw invalid_argument("Invalid token: " + invalid_token);
+}
+bool is_saved_name(string_view name) {
+    return !name.empty() && is_alpha(name[0])
+        && none_of(name.begin(), name.end(), [](char c) {
+            return isspace(static_cast<unsigned char>(c));
+        });
 }
 ostream& operator<<(ostream& out, const Token& token) {
     if (holds_alternative<double>(token)) {
@@ -149,8 +197,8 @@ ostream& operator<<(ostream& out, const Token& token) {
     if (holds_alternative<UnaryFunc>(token)) {
         return out << get<UnaryFunc>(token);
     }
-    if (holds_alternative<BinaryOp::Ptr>(token)) {
-        return out << *get<BinaryOp::Ptr>(token);
+    if (holds_alternative<BinaryOp::Type>(token)) {
+        return out << BinaryOp::get(get<BinaryOp::Type>(token));
     }
     throw logic_error("Unreachable code");
 }
@@ -2,7 +2,8 @@
 
 #include "binary_operation.h"
 
-#include <sstream>
+#include <ostream>
+#include <string_view>
 #include <variant>
 
 enum UnaryFunc {
@@ -15,10 +16,17 @@ enum Brace {
 };
 std::ostream& operator<<(std::ostream& out, const Brace& brace);
 
-struct Variable {};
+//    name points into the lexed input, which must outlive the token
+struct Variable {
+    std::string_view name;
+};
 std::ostream& operator<<(std::ostream& out, const Variable& var);
 
-using BaseToken = std::variant<double, Variable, Brace, UnaryFunc, BinaryOp::Ptr>;
+//    binary operations are stored by type, so tokens are trivially copyable
+//    and lexing does not allocate; BinaryOp::get gives their properties
+using BaseToken = std::variant<
+    double, Variable, Brace, UnaryFunc, BinaryOp::Type
+>;
 class Token : public BaseToken {
     using BaseToken::BaseToken;
 
@@ -32,9 +40,14 @@ public:
     bool operator==(const T& val) const {
         return std::holds_alternative<T>(*this) && std::get<T>(*this) == val;
     }
-    
-    bool operator==(const BinaryOp::Type& op) const;
 };
 
-std::istream& operator>>(std::istream& in, Token& token);
+//    reads the token at the start of in and advances in past it; in must not
+//    start with whitespace or be empty
+Token read_token(std::string_view& in);
+//    whether name is read as a single variable
+bool is_variable_name(std::string_view name);
+//    whether SAVE accepts name: it starts with a letter and has no
+//    whitespace
+bool is_saved_name(std::string_view name);
 std::ostream& operator<<(std::ostream& out, const Token& token);